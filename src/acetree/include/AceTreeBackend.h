@@ -22,6 +22,7 @@ public:
     virtual int max() const = 0;
     virtual int current() const = 0;
     virtual QHash<QString, QString> attributes(int step) const = 0;
+    virtual QList<QHash<QString, QString>> attributesRange(int from, int to) const;
 
     virtual void undo() = 0;
     virtual void redo() = 0;
@@ -30,6 +31,9 @@ public:
 
     virtual void reset() = 0;
 
+    virtual qint64 historyMemoryUsage() const;  // Bytes held by history events
+    virtual qint64 retainedMemoryUsage() const; // Bytes of removed items kept by history
+
     inline bool canUndo() const;
     inline bool canRedo() const;
 };
@@ -47,6 +47,9 @@ public:
     bool isManaged() const;
     bool isWritable() const;
 
+    qint64 memoryUsage() const; // Estimated bytes of the item without children
+    qint64 subtreeMemoryUsage() const;
+
     // Properties
     QVariant property(const QString &key) const;
     bool setProperty(const QString &key, const QVariant &value);
@@ -13,12 +13,64 @@ public:
     ~AceTreeJournalBackend();
 
 public:
+    enum Durability {
+        NoSync,       // Leave data in application buffers
+        Flush,        // Hand data to the system after each commit
+        DataSync,     // Write data to stable storage after each commit
+        PeriodicSync, // Hand data to the system after each commit, write to storage periodically
+    };
+    Q_ENUM(Durability)
+
+    enum Compression {
+        NoCompression,
+        ZlibCompression, // Compress each transaction and checkpoint section with zlib
+    };
+    Q_ENUM(Compression)
+
     int reservedCheckPoints() const;
     void setReservedCheckPoints(int n);
 
+    // Segments on disk to fold the older half into a base checkpoint, 0 to disable
+    int compactThreshold() const;
+    void setCompactThreshold(int n);
+
+    // Transactions in a journal segment before the next one starts with a checkpoint, 0 to follow
+    // maxReservedSteps()
+    int segmentSteps() const;
+    void setSegmentSteps(int n);
+
+    // Payload bytes of transactions in a journal segment before the next one starts, 0 for no limit
+    qint64 segmentBytes() const;
+    void setSegmentBytes(qint64 bytes);
+
+    Compression compression() const;
+    void setCompression(Compression compression);
+
+    Durability durability() const;
+    void setDurability(Durability durability);
+
+    int syncInterval() const; // Milliseconds between two syncs in PeriodicSync mode
+    void setSyncInterval(int ms);
+
+    // Keep subtrees of the checkpoint serialized on recover until they are accessed
+    bool lazyLoading() const;
+    void setLazyLoading(bool on);
+
+    // Submit writes through io_uring if built with ACETREE_ENABLE_IO_URING, blocking writes are used
+    // if it is off or unavailable
+    bool ioUring() const;
+    void setIoUring(bool on);
+
     bool start(const QString &dir);
     bool recover(const QString &dir);
 
+    // Read files on the worker, setup waits for it if not finished
+    bool recoverAsync(const QString &dir);
+    bool isRecovering() const;
+
+    // Steps (first, last) dropped by recover() due to damaged journals, (0, 0) if none
+    QPair<int, int> lostSteps() const;
+
     bool switchDir(const QString &dir);
 
 public:
@@ -27,6 +79,16 @@ public:
     int min() const override;
     int max() const override;
     QHash<QString, QString> attributes(int step) const override;
+    QList<QHash<QString, QString>> attributesRange(int from, int to) const override;
+
+signals:
+    void recoverProgress(qint64 bytesRead, qint64 bytesTotal);
+
+    // Root of the checkpoint before the journal is replayed, must not be changed. It is valid until
+    // recoverFinished() is emitted, also if the recovery fails
+    void recoverRootLoaded(const AceTreeItem *root);
+
+    void recoverFinished(bool success);
 
 protected:
     virtual bool createWarningFile(const QString &dir);
@@ -16,6 +16,12 @@ public:
     int maxReservedSteps() const;
     void setMaxReservedSteps(int steps);
 
+    qint64 maxReservedBytes() const; // 0 means unlimited
+    void setMaxReservedBytes(qint64 bytes); // Applies to history and retained items
+
+    bool compactHistory() const;
+    void setCompactHistory(bool compact); // Store committed transactions in a contiguous buffer
+
 public:
     void setup(AceTreeModel *model) override;
 
@@ -33,6 +39,9 @@ public:
 
     void reset() override;
 
+    qint64 historyMemoryUsage() const override;
+    qint64 retainedMemoryUsage() const override;
+
 protected:
     AceTreeMemBackend(AceTreeMemBackendPrivate &d, QObject *parent = nullptr);
 
@@ -32,6 +32,8 @@ public:
 
     void reset();
 
+    qint64 memoryUsage() const; // Estimated bytes of the tree, excluding history
+
 public:
     enum StateFlag {
         TransactionFlag = 1,
@@ -60,6 +62,7 @@ public:
     int maxStep() const;
     int currentStep() const;
     QHash<QString, QString> stepAttributes(int step) const;
+    QList<QHash<QString, QString>> stepAttributes(int from, int to) const; // Steps from..to
 
     void nextStep();
     void previousStep();
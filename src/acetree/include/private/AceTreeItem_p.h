@@ -1,6 +1,7 @@
 #ifndef ACETREEITEM_P_H
 #define ACETREEITEM_P_H
 
+#include <functional>
 #include <set>
 
 #include "AceTreeEvent.h"
@@ -8,6 +9,24 @@
 
 class AceTreeEntity;
 
+struct AceTreeItemSnapshot;
+
+/*
+ * Serialized subtree of an item which is not read yet, the data is shared by all stubs
+ * read from the same checkpoint.
+ *
+ */
+struct AceTreeItemStub {
+    QByteArray data;
+    int offset;
+    int size;
+    int version; // QDataStream version
+
+    // Indexes of the subtree are within the range
+    size_t minIndex;
+    size_t maxIndex;
+};
+
 class AceTreeItemPrivate {
     Q_DECLARE_PUBLIC(AceTreeItem)
 public:
@@ -42,11 +61,27 @@ public:
     // For AceTreeEntity cache
     AceTreeEntity *entity;
 
+    // Pending copy requested by the journal, guarded by model's snapshot mutex
+    AceTreeItemSnapshot *snapshot;
+
+    // Data to read on first access if the item is a stub
+    AceTreeItemStub *stub;
+
+    // Estimated memory usage, maintained by the mutation helpers
+    qint64 ownBytes;
+    qint64 subtreeBytes;
+
     bool testModifiable(const char *func) const;
     bool testInsertable(const char *func, const AceTreeItem *item) const;
 
     void sendEvent(AceTreeEvent *event);
     void changeManaged(bool managed);
+    void detachSnapshots();
+
+    void changeBytes(qint64 own, qint64 children = 0);
+    void resetBytes();
+
+    void materialize();
 
     void setProperty_helper(const QString &key, const QVariant &value);
     void replaceBytes_helper(int index, const QByteArray &bytes);
@@ -63,8 +98,24 @@ public:
 public:
     static AceTreeItem *read_helper(QDataStream &in, bool user);
     void write_helper(QDataStream &out, bool user) const;
+
+    // Direct children are read or written by the callback, used to split a tree in parts
+    using ChildReader = std::function<AceTreeItem *(QDataStream &)>;
+    using ChildWriter = std::function<void(QDataStream &, const AceTreeItem *)>;
+    static AceTreeItem *read_helper(QDataStream &in, bool user, const ChildReader &readChild);
+    void write_helper(QDataStream &out, bool user, const ChildWriter &writeChild) const;
     AceTreeItem *clone_helper(bool user) const;
 
+    // A stub only has its index until materialized
+    static AceTreeItem *createStub(const QByteArray &data, int offset, int size, int version,
+                                   size_t minIndex, size_t maxIndex);
+
+    static inline AceTreeItem *load(AceTreeItem *item) {
+        if (item && item->d_func()->stub)
+            item->d_func()->materialize();
+        return item;
+    }
+
     static inline AceTreeItemPrivate *get(AceTreeItem *item) {
         return item->d_func();
     }
@@ -81,6 +132,9 @@ public:
 
     static void forceDeleteItem(AceTreeItem *item);
 
+    static qint64 variantBytes(const QVariant &var);
+    static qint64 entryBytes(const QString &key, const QVariant &value);
+
     static inline bool executeEvent(AceTreeEvent *event, bool undo) {
         return event->execute(undo);
     }
@@ -4,11 +4,27 @@
 #include <QSet>
 #include <QStack>
 
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
 
 #include "AceTreeItem_p.h"
 #include "AceTreeModel.h"
 
+class AceTreeModelPrivate;
+
+/*
+ * Deferred copy of an item referenced by a pending journal operation. The source
+ * item stays pinned until the copy is taken by the worker, or until the main thread
+ * is about to change or delete it, whichever comes first.
+ *
+ */
+struct AceTreeItemSnapshot {
+    AceTreeModelPrivate *model;
+    AceTreeItem *source; // Null after copied
+    AceTreeItem *copy;
+};
+
 class AceTreeModelPrivate {
     Q_DECLARE_PUBLIC(AceTreeModel)
 public:
@@ -40,9 +56,28 @@ public:
     int addIndex(AceTreeItem *item, size_t idx = 0);
     void removeIndex(size_t index);
 
+    // Stubs in model, the items inside are indexed after materialized
+    QSet<AceTreeItem *> stubs;
+
+    AceTreeItem *findInStubs(size_t index);
+
+    // Same as itemFromIndex() but a stub found is not materialized
+    AceTreeItem *findIndex(size_t index);
+
     void event_helper(AceTreeEvent *e);
     void propagate_model(AceTreeItem *item);
 
+    // Snapshots of items referenced by pending journal operations
+    std::mutex snapshotMtx;
+    std::atomic_int snapshotCount;
+
+    AceTreeItemSnapshot *createSnapshot(AceTreeItem *item);
+    void detachSnapshots(AceTreeItem *item, bool recursive = false);
+    void detachSnapshot_helper(AceTreeItemSnapshot *snapshot);
+
+    static AceTreeItem *takeSnapshot(AceTreeItemSnapshot *snapshot);
+    static void releaseSnapshot(AceTreeItemSnapshot *snapshot);
+
     static inline AceTreeModelPrivate *get(AceTreeModel *model) {
         return model->d_func();
     }
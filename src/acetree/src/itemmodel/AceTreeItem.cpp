@@ -40,6 +40,21 @@ QDebug operator<<(QDebug debug, AceTreeItem *item) {
                            << ")";
 }
 
+// Memory estimation
+static inline qint64 stringBytes(const QString &s) {
+    return s.size() * qint64(sizeof(QChar));
+}
+
+static const qint64 itemBytes = sizeof(AceTreeItem) + sizeof(AceTreeItemPrivate);
+
+static const qint64 rowBytes = sizeof(AceTreeItem *);
+
+static const qint64 recordBytes = 2 * (sizeof(int) + sizeof(AceTreeItem *)); // records and indexes
+
+static inline qint64 elementBytes(const QString &key) {
+    return 2 * (stringBytes(key) + qint64(sizeof(AceTreeItem *))); // set and indexes
+}
+
 // Item
 AceTreeItemPrivate::AceTreeItemPrivate() {
     is_clearing = false;
@@ -51,6 +66,11 @@ AceTreeItemPrivate::AceTreeItemPrivate() {
     m_index = 0;
 
     entity = nullptr;
+    snapshot = nullptr;
+    stub = nullptr;
+
+    ownBytes = itemBytes;
+    subtreeBytes = itemBytes;
 }
 
 AceTreeItemPrivate::~AceTreeItemPrivate() {
@@ -65,8 +85,11 @@ AceTreeItemPrivate::~AceTreeItemPrivate() {
         }
 
         auto d = model->d_func();
-        if (!d->is_clearing)
+        if (!d->is_clearing) {
             model->d_func()->removeIndex(m_index);
+            if (stub)
+                d->stubs.remove(q);
+        }
     } else if (parent && !parent->d_func()->is_clearing) {
         switch (status) {
             case AceTreeItem::Row:
@@ -86,6 +109,8 @@ AceTreeItemPrivate::~AceTreeItemPrivate() {
     qDeleteAll(vector);
     qDeleteAll(set);
     qDeleteAll(records);
+
+    delete stub;
 }
 
 void AceTreeItemPrivate::init() {
@@ -142,9 +167,112 @@ void AceTreeItemPrivate::changeManaged(bool managed) {
     });
 }
 
+void AceTreeItemPrivate::detachSnapshots() {
+    Q_Q(AceTreeItem);
+    if (stub)
+        materialize(); // Read fully before any change
+    if (model)
+        model->d_func()->detachSnapshots(q);
+}
+
+void AceTreeItemPrivate::changeBytes(qint64 own, qint64 children) {
+    ownBytes += own;
+
+    auto delta = own + children;
+    if (delta == 0)
+        return;
+    for (auto d = this; d; d = d->parent ? d->parent->d_func() : nullptr) {
+        d->subtreeBytes += delta;
+    }
+}
+
+void AceTreeItemPrivate::resetBytes() {
+    // Children should be up to date
+    qint64 bytes = itemBytes;
+    qint64 children = 0;
+    for (auto it = properties.begin(); it != properties.end(); ++it)
+        bytes += entryBytes(it.key(), it.value());
+    for (auto it = dynamicData.begin(); it != dynamicData.end(); ++it)
+        bytes += entryBytes(it.key(), it.value());
+    bytes += byteArray.size();
+    for (const auto &child : qAsConst(vector)) {
+        bytes += rowBytes;
+        children += child->d_func()->subtreeBytes;
+    }
+    for (auto it = records.begin(); it != records.end(); ++it) {
+        bytes += recordBytes;
+        children += it.value()->d_func()->subtreeBytes;
+    }
+    for (auto it = set.begin(); it != set.end(); ++it) {
+        bytes += elementBytes(it.key());
+        children += it.value()->d_func()->subtreeBytes;
+    }
+    ownBytes = bytes;
+    subtreeBytes = bytes + children;
+}
+
+void AceTreeItemPrivate::materialize() {
+    Q_Q(AceTreeItem);
+
+    // Pending copies of the ancestors still see the stub
+    if (model) {
+        model->d_func()->detachSnapshots(q);
+        model->d_func()->stubs.remove(q);
+    }
+
+    auto s = stub;
+    stub = nullptr;
+
+    auto data = QByteArray::fromRawData(s->data.constData() + s->offset, s->size);
+    QDataStream in(data);
+    in.setVersion(s->version);
+    auto item = read_helper(in, false);
+    delete s;
+    if (!item) {
+        myWarning(__func__) << "read stub failed" << q;
+        return;
+    }
+
+    // Take content
+    auto d = item->d_func();
+    properties.swap(d->properties);
+    byteArray.swap(d->byteArray);
+    vector.swap(d->vector);
+    records.swap(d->records);
+    set.swap(d->set);
+    recordIds.swap(d->recordIds);
+    recordIndexes.swap(d->recordIndexes);
+    setIndexes.swap(d->setIndexes);
+    delete item;
+
+    auto adopt = [this, q](AceTreeItem *child) {
+        auto d2 = child->d_func();
+        d2->parent = q;
+        if (m_managed)
+            d2->changeManaged(true);
+        if (model)
+            model->d_func()->propagate_model(child);
+    };
+    for (const auto &child : qAsConst(vector))
+        adopt(child);
+    for (const auto &child : qAsConst(records))
+        adopt(child);
+    for (const auto &child : qAsConst(set))
+        adopt(child);
+
+    // Replace the estimation of the stub
+    auto oldBytes = subtreeBytes;
+    resetBytes();
+    auto delta = subtreeBytes - oldBytes;
+    for (auto p = parent; p; p = p->d_func()->parent) {
+        p->d_func()->subtreeBytes += delta;
+    }
+}
+
 void AceTreeItemPrivate::setProperty_helper(const QString &key, const QVariant &value) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     QVariant oldValue;
     auto it = properties.find(key);
@@ -152,14 +280,18 @@ void AceTreeItemPrivate::setProperty_helper(const QString &key, const QVariant &
         if (!value.isValid())
             return;
         properties.insert(key, value);
+        changeBytes(entryBytes(key, value));
     } else {
         oldValue = it.value();
-        if (!value.isValid())
+        if (!value.isValid()) {
             properties.erase(it);
-        else if (oldValue == value)
+            changeBytes(-entryBytes(key, oldValue));
+        } else if (oldValue == value) {
             return;
-        else
+        } else {
             it.value() = value;
+            changeBytes(variantBytes(value) - variantBytes(oldValue));
+        }
     }
 
     // Propagate signal
@@ -170,15 +302,18 @@ void AceTreeItemPrivate::setProperty_helper(const QString &key, const QVariant &
 void AceTreeItemPrivate::replaceBytes_helper(int index, const QByteArray &bytes) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     auto len = bytes.size();
     auto oldBytes = byteArray.mid(index, len);
 
     // Do change
+    int oldSize = byteArray.size();
     int newSize = index + len;
-    if (newSize > byteArray.size())
+    if (newSize > oldSize)
         byteArray.resize(newSize);
     byteArray.replace(index, len, bytes);
+    changeBytes(byteArray.size() - oldSize);
 
     // Propagate signal
     AceTreeBytesEvent e(AceTreeEvent::BytesReplace, q, index, bytes, oldBytes);
@@ -188,9 +323,11 @@ void AceTreeItemPrivate::replaceBytes_helper(int index, const QByteArray &bytes)
 void AceTreeItemPrivate::insertBytes_helper(int index, const QByteArray &bytes) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     // Do change
     byteArray.insert(index, bytes);
+    changeBytes(bytes.size());
 
     // Propagate signal
     AceTreeBytesEvent e(AceTreeEvent::BytesInsert, q, index, bytes);
@@ -200,11 +337,13 @@ void AceTreeItemPrivate::insertBytes_helper(int index, const QByteArray &bytes)
 void AceTreeItemPrivate::removeBytes_helper(int index, int size) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     auto bytes = byteArray.mid(index, size);
 
     // Do change
     byteArray.remove(index, size);
+    changeBytes(-bytes.size());
 
     // Propagate signal
     AceTreeBytesEvent e(AceTreeEvent::BytesRemove, q, index, bytes);
@@ -214,20 +353,24 @@ void AceTreeItemPrivate::removeBytes_helper(int index, int size) {
 void AceTreeItemPrivate::insertRows_helper(int index, const QVector<AceTreeItem *> &items) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     // Do change
+    qint64 children = 0;
     vector.insert(vector.begin() + index, items.size(), nullptr);
     for (int i = 0; i < items.size(); ++i) {
         auto item = items[i];
         auto d = item->d_func();
         vector[index + i] = item;
         d->parent = q;
+        children += d->subtreeBytes;
 
         // Update status
         d->status = AceTreeItem::Row;
         if (d->m_managed)
             d->changeManaged(false);
     }
+    changeBytes(items.size() * rowBytes, children);
 
     // Propagate signal
     AceTreeRowsInsDelEvent e(AceTreeEvent::RowsInsert, q, index, items);
@@ -265,6 +408,7 @@ static void arrayMove(Array<T> &arr, int index, int count, int dest) {
 void AceTreeItemPrivate::moveRows_helper(int index, int count, int dest) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     // Pre-Propagate signal
     AceTreeRowsMoveEvent e1(AceTreeEvent::RowsAboutToMove, q, index, count, dest);
@@ -281,6 +425,7 @@ void AceTreeItemPrivate::moveRows_helper(int index, int count, int dest) {
 void AceTreeItemPrivate::removeRows_helper(int index, int count) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     QVector<AceTreeItem *> tmp;
     tmp.resize(count);
@@ -291,9 +436,11 @@ void AceTreeItemPrivate::removeRows_helper(int index, int count) {
     sendEvent(&e1);
 
     // Do change
+    qint64 children = 0;
     for (const auto &item : qAsConst(tmp)) {
         auto d = item->d_func();
         d->parent = nullptr;
+        children += d->subtreeBytes;
 
         // Update status
         d->status = AceTreeItem::Root;
@@ -301,6 +448,7 @@ void AceTreeItemPrivate::removeRows_helper(int index, int count) {
             d->changeManaged(true);
     }
     vector.erase(vector.begin() + index, vector.begin() + index + count);
+    changeBytes(-count * rowBytes, -children);
 
     // Propagate signal
     AceTreeRowsInsDelEvent e2(AceTreeEvent::RowsRemove, q, index, tmp);
@@ -310,6 +458,7 @@ void AceTreeItemPrivate::removeRows_helper(int index, int count) {
 void AceTreeItemPrivate::addRecord_helper(int seq, AceTreeItem *item) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     // Do change
     auto d = item->d_func();
@@ -318,6 +467,7 @@ void AceTreeItemPrivate::addRecord_helper(int seq, AceTreeItem *item) {
     records.insert(seq, item);
     recordIds.insert(seq);
     recordIndexes.insert(item, seq);
+    changeBytes(recordBytes, d->subtreeBytes);
 
     // Update status
     d->status = AceTreeItem::Record;
@@ -332,6 +482,7 @@ void AceTreeItemPrivate::addRecord_helper(int seq, AceTreeItem *item) {
 void AceTreeItemPrivate::removeRecord_helper(int seq) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     auto it = records.find(seq);
     auto item = it.value();
@@ -346,6 +497,7 @@ void AceTreeItemPrivate::removeRecord_helper(int seq) {
     records.erase(it);
     recordIds.erase(seq);
     recordIndexes.remove(item);
+    changeBytes(-recordBytes, -d->subtreeBytes);
 
     // Update status
     d->status = AceTreeItem::Root;
@@ -360,12 +512,14 @@ void AceTreeItemPrivate::removeRecord_helper(int seq) {
 void AceTreeItemPrivate::addElement_helper(const QString &key, AceTreeItem *item) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     // Do change
     auto d = item->d_func();
     d->parent = q;
     set.insert(key, item);
     setIndexes.insert(item, key);
+    changeBytes(elementBytes(key), d->subtreeBytes);
 
     // Update status
     d->status = AceTreeItem::Element;
@@ -380,6 +534,7 @@ void AceTreeItemPrivate::addElement_helper(const QString &key, AceTreeItem *item
 void AceTreeItemPrivate::removeElement_helper(const QString &key) {
     Q_Q(AceTreeItem);
     AceTreeModelPrivate::InterruptGuard _guard(model);
+    detachSnapshots();
 
     auto it = set.find(key);
     auto item = it.value();
@@ -393,6 +548,7 @@ void AceTreeItemPrivate::removeElement_helper(const QString &key) {
     d->parent = nullptr;
     set.erase(it);
     setIndexes.remove(item);
+    changeBytes(-elementBytes(key), -d->subtreeBytes);
 
     // Update status
     d->status = AceTreeItem::Root;
@@ -405,6 +561,11 @@ void AceTreeItemPrivate::removeElement_helper(const QString &key) {
 }
 
 AceTreeItem *AceTreeItemPrivate::read_helper(QDataStream &in, bool user) {
+    return read_helper(in, user, nullptr);
+}
+
+AceTreeItem *AceTreeItemPrivate::read_helper(QDataStream &in, bool user,
+                                             const ChildReader &readChild) {
     // Read head
     char sign[sizeof(SIGN_TREE_ITEM) - 1];
     in.readRawData(sign, sizeof(sign));
@@ -443,7 +604,7 @@ AceTreeItem *AceTreeItemPrivate::read_helper(QDataStream &in, bool user) {
     }
     d->vector.reserve(size);
     for (int i = 0; i < size; ++i) {
-        auto child = read_helper(in, user);
+        auto child = readChild ? readChild(in) : read_helper(in, user);
         if (!child) {
             myWarning(__func__) << "read vector item failed";
             goto abort;
@@ -467,7 +628,7 @@ AceTreeItem *AceTreeItemPrivate::read_helper(QDataStream &in, bool user) {
     for (int i = 0; i < size; ++i) {
         int seq;
         in >> seq;
-        auto child = read_helper(in, user);
+        auto child = readChild ? readChild(in) : read_helper(in, user);
         if (!child) {
             myWarning(__func__) << "read record item failed";
             goto abort;
@@ -498,7 +659,7 @@ AceTreeItem *AceTreeItemPrivate::read_helper(QDataStream &in, bool user) {
             goto abort;
         }
 
-        auto child = read_helper(in, user);
+        auto child = readChild ? readChild(in) : read_helper(in, user);
         if (!child) {
             myWarning(__func__) << "read set item failed";
             goto abort;
@@ -512,6 +673,7 @@ AceTreeItem *AceTreeItemPrivate::read_helper(QDataStream &in, bool user) {
         d->setIndexes.insert(child, key);
     }
 
+    d->resetBytes();
     return item;
 
 abort:
@@ -520,6 +682,23 @@ abort:
 }
 
 void AceTreeItemPrivate::write_helper(QDataStream &out, bool user) const {
+    write_helper(out, user, nullptr);
+}
+
+void AceTreeItemPrivate::write_helper(QDataStream &out, bool user,
+                                      const ChildWriter &writeChild) const {
+    if (stub) {
+        if (!user) {
+            out.writeRawData(stub->data.constData() + stub->offset, stub->size);
+            return;
+        }
+        const_cast<AceTreeItemPrivate *>(this)->materialize();
+    }
+
+    auto writeItem = [&](const AceTreeItem *item) {
+        writeChild ? writeChild(out, item) : item->d_func()->write_helper(out, user);
+    };
+
     out.writeRawData(SIGN_TREE_ITEM, sizeof(SIGN_TREE_ITEM) - 1);
 
     auto d = this;
@@ -536,25 +715,34 @@ void AceTreeItemPrivate::write_helper(QDataStream &out, bool user) const {
     // Write vector
     out << qint32(d->vector.size());
     for (const auto &item : d->vector) {
-        item->d_func()->write_helper(out, user);
+        writeItem(item);
     }
 
     // Write record table
     out << qint32(d->records.size());
     for (auto it = d->records.begin(); it != d->records.end(); ++it) {
         out << it.key();
-        it.value()->d_func()->write_helper(out, user);
+        writeItem(it.value());
     }
 
     // Write set
     out << qint32(d->set.size());
     for (auto it = d->set.begin(); it != d->set.end(); ++it) {
         AceTreePrivate::operator<<(out, it.key());
-        it.value()->d_func()->write_helper(out, user);
+        writeItem(it.value());
     }
 }
 
 AceTreeItem *AceTreeItemPrivate::clone_helper(bool user) const {
+    if (stub) {
+        if (!user) {
+            // Share data with the stub
+            return createStub(stub->data, stub->offset, stub->size, stub->version,
+                              stub->minIndex, stub->maxIndex);
+        }
+        const_cast<AceTreeItemPrivate *>(this)->materialize();
+    }
+
     auto d = this;
     auto item = new AceTreeItem();
 
@@ -601,6 +789,35 @@ AceTreeItem *AceTreeItemPrivate::clone_helper(bool user) const {
         d2->setIndexes.insert(newChild, it.key());
     }
 
+    d2->resetBytes();
+    return item;
+}
+
+AceTreeItem *AceTreeItemPrivate::createStub(const QByteArray &data, int offset, int size,
+                                            int version, size_t minIndex, size_t maxIndex) {
+    auto bytes = QByteArray::fromRawData(data.constData() + offset, size);
+    QDataStream in(bytes);
+    in.setVersion(version);
+
+    // Read head
+    char sign[sizeof(SIGN_TREE_ITEM) - 1];
+    in.readRawData(sign, sizeof(sign));
+    if (memcmp(SIGN_TREE_ITEM, sign, sizeof(sign)) != 0) {
+        return nullptr;
+    }
+
+    // Read index
+    size_t index;
+    in >> index;
+    if (in.status() != QDataStream::Ok) {
+        return nullptr;
+    }
+
+    auto item = new AceTreeItem();
+    auto d = item->d_func();
+    d->m_index = index;
+    d->stub = new AceTreeItemStub{data, offset, size, version, minIndex, maxIndex};
+    d->changeBytes(size); // Estimated by the serialized size
     return item;
 }
 
@@ -616,10 +833,52 @@ void AceTreeItemPrivate::propagate(AceTreeItem *item,
         propagate(child, func);
 }
 
+qint64 AceTreeItemPrivate::variantBytes(const QVariant &var) {
+    qint64 size = sizeof(QVariant);
+    switch (var.userType()) {
+        case QMetaType::QString:
+            size += stringBytes(var.toString());
+            break;
+        case QMetaType::QByteArray:
+            size += var.toByteArray().size();
+            break;
+        case QMetaType::QVariantList: {
+            const auto &list = var.toList();
+            for (const auto &item : list)
+                size += variantBytes(item);
+            break;
+        }
+        case QMetaType::QVariantHash: {
+            const auto &hash = var.toHash();
+            for (auto it = hash.begin(); it != hash.end(); ++it)
+                size += entryBytes(it.key(), it.value());
+            break;
+        }
+        case QMetaType::QVariantMap: {
+            const auto &map = var.toMap();
+            for (auto it = map.begin(); it != map.end(); ++it)
+                size += entryBytes(it.key(), it.value());
+            break;
+        }
+        default:
+            break;
+    }
+    return size;
+}
+
+qint64 AceTreeItemPrivate::entryBytes(const QString &key, const QVariant &value) {
+    return stringBytes(key) + variantBytes(value);
+}
+
 void AceTreeItemPrivate::forceDeleteItem(AceTreeItem *item) {
     if (!item)
         return;
 
+    // Pending snapshots must be copied before deleting
+    auto model = item->d_func()->model;
+    if (model)
+        model->d_func()->detachSnapshots(item, true);
+
     AceTreeItemPrivate::propagate(item, [](AceTreeItem *item) {
         item->d_func()->allowDelete = true; //
     });
@@ -652,6 +911,7 @@ QVariant AceTreeItem::dynamicData(const QString &key) const {
 
 void AceTreeItem::setDynamicData(const QString &key, const QVariant &value) {
     Q_D(AceTreeItem);
+    d->detachSnapshots();
 
     QVariant oldValue;
     auto it = d->dynamicData.find(key);
@@ -659,14 +919,19 @@ void AceTreeItem::setDynamicData(const QString &key, const QVariant &value) {
         if (!value.isValid())
             return;
         d->dynamicData.insert(key, value);
+        d->changeBytes(AceTreeItemPrivate::entryBytes(key, value));
     } else {
         oldValue = it.value();
-        if (!value.isValid())
+        if (!value.isValid()) {
             d->dynamicData.erase(it);
-        else if (oldValue == value)
+            d->changeBytes(-AceTreeItemPrivate::entryBytes(key, oldValue));
+        } else if (oldValue == value) {
             return;
-        else
+        } else {
             it.value() = value;
+            d->changeBytes(AceTreeItemPrivate::variantBytes(value) -
+                           AceTreeItemPrivate::variantBytes(oldValue));
+        }
     }
 
     // Propagate signal
@@ -717,6 +982,16 @@ bool AceTreeItem::isWritable() const {
     return d->model ? d->model->isWritable() : true;
 }
 
+qint64 AceTreeItem::memoryUsage() const {
+    Q_D(const AceTreeItem);
+    return d->ownBytes;
+}
+
+qint64 AceTreeItem::subtreeMemoryUsage() const {
+    Q_D(const AceTreeItem);
+    return d->subtreeBytes;
+}
+
 QVariant AceTreeItem::property(const QString &key) const {
     Q_D(const AceTreeItem);
     return d->properties.value(key, {});
@@ -894,11 +1169,15 @@ bool AceTreeItem::removeRow(AceTreeItem *item) {
 
 AceTreeItem *AceTreeItem::row(int index) const {
     Q_D(const AceTreeItem);
-    return (index >= 0 && index < d->vector.size()) ? d->vector.at(index) : nullptr;
+    return (index >= 0 && index < d->vector.size())
+               ? AceTreeItemPrivate::load(d->vector.at(index))
+               : nullptr;
 }
 
 QVector<AceTreeItem *> AceTreeItem::rows() const {
     Q_D(const AceTreeItem);
+    for (const auto &item : d->vector)
+        AceTreeItemPrivate::load(item);
     return d->vector;
 }
 
@@ -969,7 +1248,7 @@ bool AceTreeItem::removeRecord(AceTreeItem *item) {
 
 AceTreeItem *AceTreeItem::record(int seq) {
     Q_D(const AceTreeItem);
-    return d->records.value(seq, nullptr);
+    return AceTreeItemPrivate::load(d->records.value(seq, nullptr));
 }
 
 int AceTreeItem::recordSequenceOf(AceTreeItem *item) const {
@@ -988,7 +1267,7 @@ QMap<int, AceTreeItem *> AceTreeItem::recordMap() const {
     Q_D(const AceTreeItem);
     QMap<int, AceTreeItem *> res;
     for (auto it = d->records.begin(); it != d->records.end(); ++it) {
-        res.insert(it.key(), it.value());
+        res.insert(it.key(), AceTreeItemPrivate::load(it.value()));
     }
     return res;
 }
@@ -1060,7 +1339,7 @@ bool AceTreeItem::removeElement(AceTreeItem *item) {
 
 AceTreeItem *AceTreeItem::element(const QString &key) const {
     Q_D(const AceTreeItem);
-    return d->set.value(key, nullptr);
+    return AceTreeItemPrivate::load(d->set.value(key, nullptr));
 }
 
 QString AceTreeItem::elementKeyOf(AceTreeItem *item) const {
@@ -1082,11 +1361,15 @@ QStringList AceTreeItem::elementKeys() const {
 
 QList<AceTreeItem *> AceTreeItem::elements() const {
     Q_D(const AceTreeItem);
+    for (const auto &item : d->set)
+        AceTreeItemPrivate::load(item);
     return d->set.values();
 }
 
 QHash<QString, AceTreeItem *> AceTreeItem::elementHash() const {
     Q_D(const AceTreeItem);
+    for (const auto &item : d->set)
+        AceTreeItemPrivate::load(item);
     return d->set;
 }
 
@@ -1094,7 +1377,7 @@ QMap<QString, AceTreeItem *> AceTreeItem::elementMap() const {
     Q_D(const AceTreeItem);
     QMap<QString, AceTreeItem *> res;
     for (auto it = d->set.begin(); it != d->set.end(); ++it) {
-        res.insert(it.key(), it.value());
+        res.insert(it.key(), AceTreeItemPrivate::load(it.value()));
     }
     return res;
 }
@@ -25,6 +25,7 @@ AceTreeModelPrivate::AceTreeModelPrivate() {
     m_metaOperation = false;
     maxIndex = 0;
     rootItem = nullptr;
+    snapshotCount = 0;
 }
 
 AceTreeModelPrivate::~AceTreeModelPrivate() {
@@ -108,9 +109,116 @@ void AceTreeModelPrivate::propagate_model(AceTreeItem *item) {
         auto d = item->d_func();
         d->m_index = addIndex(item, d->m_index);
         d->model = q;
+        if (d->stub)
+            stubs.insert(item);
     });
 }
 
+AceTreeItem *AceTreeModelPrivate::findInStubs(size_t index) {
+    // Materialize only the stubs covering the index, a missing one loads nothing
+    while (true) {
+        AceTreeItem *item = nullptr;
+        for (const auto &stub : qAsConst(stubs)) {
+            auto s = stub->d_func()->stub;
+            if (index >= s->minIndex && index <= s->maxIndex) {
+                item = stub;
+                break;
+            }
+        }
+        if (!item)
+            return nullptr;
+        AceTreeItemPrivate::load(item);
+
+        auto it = indexes.find(index);
+        if (it != indexes.end())
+            return it->second;
+    }
+}
+
+AceTreeItem *AceTreeModelPrivate::findIndex(size_t index) {
+    if (index == 0)
+        return nullptr;
+    auto it = indexes.find(index);
+    if (it == indexes.end())
+        return findInStubs(index);
+    return it->second;
+}
+
+AceTreeItemSnapshot *AceTreeModelPrivate::createSnapshot(AceTreeItem *item) {
+    auto snapshot = new AceTreeItemSnapshot{this, item, nullptr};
+
+    std::unique_lock<std::mutex> lock(snapshotMtx);
+    auto d = item->d_func();
+    if (d->snapshot) {
+        // Only one pending snapshot is kept for an item
+        detachSnapshot_helper(d->snapshot);
+    }
+    d->snapshot = snapshot;
+    snapshotCount++;
+    return snapshot;
+}
+
+void AceTreeModelPrivate::detachSnapshots(AceTreeItem *item, bool recursive) {
+    // Nothing is pinned in most cases
+    if (snapshotCount.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(snapshotMtx);
+
+    // An item changes, so does its ancestors
+    for (auto p = item; p; p = p->d_func()->parent) {
+        auto d = p->d_func();
+        if (d->snapshot)
+            detachSnapshot_helper(d->snapshot);
+    }
+
+    if (recursive) {
+        AceTreeItemPrivate::propagate(item, [this](AceTreeItem *item) {
+            auto d = item->d_func();
+            if (d->snapshot)
+                detachSnapshot_helper(d->snapshot);
+        });
+    }
+}
+
+void AceTreeModelPrivate::detachSnapshot_helper(AceTreeItemSnapshot *snapshot) {
+    // Must be called with snapshot mutex locked
+    auto d = snapshot->source->d_func();
+    snapshot->copy = d->clone_helper(false);
+    snapshot->source = nullptr;
+    d->snapshot = nullptr;
+    snapshotCount--;
+}
+
+AceTreeItem *AceTreeModelPrivate::takeSnapshot(AceTreeItemSnapshot *snapshot) {
+    auto d = snapshot->model;
+
+    std::unique_lock<std::mutex> lock(d->snapshotMtx);
+    if (snapshot->source) {
+        d->detachSnapshot_helper(snapshot);
+    }
+    lock.unlock();
+
+    auto item = snapshot->copy;
+    delete snapshot;
+    return item;
+}
+
+void AceTreeModelPrivate::releaseSnapshot(AceTreeItemSnapshot *snapshot) {
+    auto d = snapshot->model;
+
+    std::unique_lock<std::mutex> lock(d->snapshotMtx);
+    if (snapshot->source) {
+        snapshot->source->d_func()->snapshot = nullptr;
+        d->snapshotCount--;
+    }
+    lock.unlock();
+
+    delete snapshot->copy;
+    delete snapshot;
+}
+
 AceTreeModel::AceTreeModel(QObject *parent) : AceTreeModel(*new AceTreeModelPrivate(), parent) {
     Q_D(AceTreeModel);
     d->backend = new AceTreeMemBackend(this);
@@ -155,12 +263,7 @@ bool AceTreeModel::isWritable() const {
 
 AceTreeItem *AceTreeModel::itemFromIndex(size_t index) const {
     Q_D(const AceTreeModel);
-    if (index == 0)
-        return nullptr;
-    auto it = d->indexes.find(index);
-    if (it == d->indexes.end())
-        return nullptr;
-    return it->second;
+    return AceTreeItemPrivate::load(const_cast<AceTreeModelPrivate *>(d)->findIndex(index));
 }
 
 AceTreeItem *AceTreeModel::rootItem() const {
@@ -202,6 +305,11 @@ void AceTreeModel::reset() {
     d->backend->reset();
 }
 
+qint64 AceTreeModel::memoryUsage() const {
+    Q_D(const AceTreeModel);
+    return d->rootItem ? AceTreeItemPrivate::get(d->rootItem)->subtreeBytes : 0;
+}
+
 AceTreeModel::State AceTreeModel::state() const {
     Q_D(const AceTreeModel);
     return d->m_state;
@@ -276,6 +384,11 @@ QHash<QString, QString> AceTreeModel::stepAttributes(int step) const {
     return d->backend->attributes(step);
 }
 
+QList<QHash<QString, QString>> AceTreeModel::stepAttributes(int from, int to) const {
+    Q_D(const AceTreeModel);
+    return d->backend->attributesRange(from, to);
+}
+
 void AceTreeModel::nextStep() {
     Q_D(AceTreeModel);
 
@@ -0,0 +1,116 @@
+#include "Checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#    define CHECKSUM_X86
+#    include <nmmintrin.h>
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#    endif
+#elif defined(__ARM_FEATURE_CRC32)
+#    define CHECKSUM_ARM
+#    include <arm_acle.h>
+#endif
+
+namespace Checksum {
+
+    static const quint32 *crcTable() {
+        static const struct Table {
+            quint32 data[256];
+            Table() {
+                for (quint32 i = 0; i < 256; ++i) {
+                    quint32 crc = i;
+                    for (int j = 0; j < 8; ++j) {
+                        crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : (crc >> 1);
+                    }
+                    data[i] = crc;
+                }
+            }
+        } table;
+        return table.data;
+    }
+
+    static quint32 crc32c_sw(quint32 crc, const uchar *p, qint64 len) {
+        auto table = crcTable();
+        for (; len > 0; --len) {
+            crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(CHECKSUM_X86)
+#    if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+#    endif
+    static quint32 crc32c_hw(quint32 crc, const uchar *p, qint64 len) {
+#    if defined(__x86_64__) || defined(_M_X64)
+        quint64 crc64 = crc;
+        for (; len >= 8; len -= 8, p += 8) {
+            quint64 val;
+            memcpy(&val, p, 8);
+            crc64 = _mm_crc32_u64(crc64, val);
+        }
+        crc = quint32(crc64);
+#    endif
+        for (; len >= 4; len -= 4, p += 4) {
+            quint32 val;
+            memcpy(&val, p, 4);
+            crc = _mm_crc32_u32(crc, val);
+        }
+        for (; len > 0; --len) {
+            crc = _mm_crc32_u8(crc, *p++);
+        }
+        return crc;
+    }
+
+    static bool detectHardware() {
+#    if defined(__GNUC__) || defined(__clang__)
+        return __builtin_cpu_supports("sse4.2");
+#    elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#    else
+        return false;
+#    endif
+    }
+#elif defined(CHECKSUM_ARM)
+    static quint32 crc32c_hw(quint32 crc, const uchar *p, qint64 len) {
+        for (; len >= 8; len -= 8, p += 8) {
+            quint64 val;
+            memcpy(&val, p, 8);
+            crc = __crc32cd(crc, val);
+        }
+        for (; len > 0; --len) {
+            crc = __crc32cb(crc, *p++);
+        }
+        return crc;
+    }
+
+    static bool detectHardware() {
+        return true; // Enabled at compile time
+    }
+#endif
+
+    bool hasHardwareCrc32c() {
+#if defined(CHECKSUM_X86) || defined(CHECKSUM_ARM)
+        static const bool res = detectHardware();
+        return res;
+#else
+        return false;
+#endif
+    }
+
+    quint32 crc32c(const void *data, qint64 len, quint32 crc) {
+        auto p = static_cast<const uchar *>(data);
+        crc = ~crc;
+#if defined(CHECKSUM_X86) || defined(CHECKSUM_ARM)
+        if (hasHardwareCrc32c()) {
+            return ~crc32c_hw(crc, p, len);
+        }
+#endif
+        return ~crc32c_sw(crc, p, len);
+    }
+
+}
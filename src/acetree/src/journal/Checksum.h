@@ -0,0 +1,15 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QtGlobal>
+
+namespace Checksum {
+
+    // CRC-32C (Castagnoli), pass the previous result to continue over several buffers
+    quint32 crc32c(const void *data, qint64 len, quint32 crc = 0);
+
+    bool hasHardwareCrc32c();
+
+}
+
+#endif // CHECKSUM_H
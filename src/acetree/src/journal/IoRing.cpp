@@ -0,0 +1,210 @@
+#include "IoRing.h"
+
+#ifdef ACETREE_ENABLE_IO_URING
+#    include <cerrno>
+#    include <cstdint>
+
+#    include <liburing.h>
+#    include <unistd.h>
+#endif
+
+IoRing::IoRing()
+    : ring(nullptr), frontId(0), tickets(0), running(0), drainNext(false), error(false) {
+}
+
+void IoRing::write(int fd, qint64 pos, const QByteArray &data) {
+    queued.append({fd, pos, data, false, drainNext, 0, 0, false});
+    drainNext = false;
+}
+
+void IoRing::sync(int fd) {
+    queued.append({fd, 0, {}, true, drainNext, 0, 0, false});
+    drainNext = false;
+}
+
+void IoRing::barrier() {
+    drainNext = true;
+}
+
+bool IoRing::takeError() {
+    bool res = error;
+    error = false;
+    return res;
+}
+
+#ifdef ACETREE_ENABLE_IO_URING
+
+// At most so many operations in flight, the completion queue is twice as large
+static constexpr unsigned kQueueDepth = 64;
+
+IoRing::~IoRing() {
+    reap(true);
+    close();
+}
+
+IoRing *IoRing::create() {
+    // May be disabled by the kernel or a sandbox
+    auto ring = new io_uring();
+    if (io_uring_queue_init(kQueueDepth, ring, 0) < 0) {
+        delete ring;
+        return nullptr;
+    }
+    auto res = new IoRing();
+    res->ring = ring;
+    return res;
+}
+
+qint64 IoRing::submit() {
+    if (queued.isEmpty()) {
+        return tickets;
+    }
+    ++tickets;
+
+    // Make room in the ring, operations too many for it are done at once after the others
+    auto size = size_t(queued.size());
+    bool direct = size > kQueueDepth;
+    while (ring && running > 0 && (direct || inflight.size() + size > kQueueDepth)) {
+        take(true);
+        finish();
+    }
+    if (ring && io_uring_sq_space_left(ring) < size) {
+        direct = true; // Never submit a part of them
+    }
+
+    auto first = inflight.size();
+    for (auto &op : queued) {
+        op.ticket = tickets;
+        op.res = -ECANCELED;
+        op.done = !ring || direct;
+        inflight.push_back(std::move(op));
+    }
+    queued.clear();
+
+    if (!ring || direct) {
+        finish();
+        return tickets;
+    }
+
+    // Each operation of a chain starts after the previous one succeeds
+    for (auto i = first; i < inflight.size(); ++i) {
+        const auto &op = inflight.at(i);
+        auto sqe = io_uring_get_sqe(ring);
+        if (op.sync) {
+            io_uring_prep_fsync(sqe, op.fd, IORING_FSYNC_DATASYNC);
+        } else {
+            io_uring_prep_write(sqe, op.fd, op.data.constData(), op.data.size(), op.pos);
+        }
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(uintptr_t(frontId + i)));
+        if (op.drain) {
+            sqe->flags |= IOSQE_IO_DRAIN;
+        }
+        if (i + 1 < inflight.size() && !inflight.at(i + 1).drain) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+
+    int ret = io_uring_submit(ring);
+    running += size_t(qMax(ret, 0));
+    if (ret != int(size)) {
+        // Entries left in the ring would run beside the redone operations, drop the ring after
+        // the submitted ones finish
+        while (running > 0 && take(true)) {
+        }
+        close();
+        finish();
+    }
+    return tickets;
+}
+
+qint64 IoRing::reap(bool block) {
+    while (ring && running > 0 && take(block)) {
+    }
+    finish();
+    return inflight.empty() ? tickets : inflight.front().ticket - 1;
+}
+
+bool IoRing::take(bool block) {
+    io_uring_cqe *cqe;
+    int ret;
+    do {
+        ret = block ? io_uring_wait_cqe(ring, &cqe) : io_uring_peek_cqe(ring, &cqe);
+    } while (block && ret == -EINTR);
+    if (ret < 0) {
+        if (block) {
+            close(); // Never finished otherwise
+        }
+        return false;
+    }
+
+    auto i = uintptr_t(io_uring_cqe_get_data(cqe)) - uintptr_t(frontId);
+    if (i < inflight.size()) {
+        auto &op = inflight.at(i);
+        op.res = cqe->res;
+        op.done = true;
+    }
+    io_uring_cqe_seen(ring, cqe);
+    --running;
+    return true;
+}
+
+void IoRing::finish() {
+    // Redo the failed operations in order without the ring, the rest of a chain is cancelled
+    while (!inflight.empty() && inflight.front().done) {
+        const auto &op = inflight.front();
+        if (op.res != (op.sync ? 0 : op.data.size())) {
+            bool ok = op.sync ? fdatasync(op.fd) == 0
+                              : pwrite(op.fd, op.data.constData(), op.data.size(), op.pos) ==
+                                    op.data.size();
+            error = error || !ok;
+        }
+        inflight.pop_front();
+        ++frontId;
+    }
+}
+
+void IoRing::close() {
+    if (!ring) {
+        return;
+    }
+
+    // Discards the entries not submitted, the unfinished operations are redone
+    io_uring_queue_exit(ring);
+    delete ring;
+    ring = nullptr;
+    running = 0;
+    for (auto &op : inflight) {
+        op.done = true;
+    }
+}
+
+#else
+
+IoRing::~IoRing() {
+}
+
+IoRing *IoRing::create() {
+    return nullptr;
+}
+
+qint64 IoRing::submit() {
+    queued.clear();
+    return tickets;
+}
+
+qint64 IoRing::reap(bool block) {
+    Q_UNUSED(block);
+    return tickets;
+}
+
+bool IoRing::take(bool block) {
+    Q_UNUSED(block);
+    return false;
+}
+
+void IoRing::finish() {
+}
+
+void IoRing::close() {
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include <deque>
+
+struct io_uring;
+
+// Writes and syncs submitted through io_uring on Linux, the caller goes on while they run. The
+// operations queued between two barriers form a chain that runs in order, chains of several
+// submissions are in flight at the same time.
+class IoRing {
+public:
+    ~IoRing();
+
+    // Null if not built with ACETREE_ENABLE_IO_URING or io_uring is unavailable
+    static IoRing *create();
+
+    // Queue operations after the previous queued one of the chain, the descriptor must stay open
+    // until the operation is done
+    void write(int fd, qint64 pos, const QByteArray &data);
+    void sync(int fd);
+
+    // Start a new chain after all operations queued or submitted before are done
+    void barrier();
+
+    // Submit the queued operations without waiting for them, returns the ticket of the submission
+    qint64 submit();
+
+    // Take finished operations, waiting for all if blocking, returns the last ticket done with all
+    // earlier ones
+    qint64 reap(bool block);
+
+    // Whether an operation failed even when redone without the ring, cleared by the call
+    bool takeError();
+
+private:
+    IoRing();
+
+    struct Op {
+        int fd;
+        qint64 pos;
+        QByteArray data; // Kept until written
+        bool sync;
+        bool drain;    // Head of a chain after a barrier
+        qint64 ticket; // Submission of the operation
+        int res;
+        bool done;
+    };
+
+    io_uring *ring; // Null after a failed submission, the operations are done at once then
+    QVector<Op> queued;
+    std::deque<Op> inflight; // Submitted in order, taken from the front when done
+    quint64 frontId;         // Id of the front one in flight
+    qint64 tickets;
+    size_t running; // Submitted and not taken
+    bool drainNext;
+    bool error;
+
+    bool take(bool block);
+    void finish();
+    void close();
+};
+
+#endif // IORING_H
@@ -75,6 +75,9 @@ namespace Operations {
 
     RowsInsertOp::~RowsInsertOp() {
         qDeleteAll(children);
+        for (const auto &snapshot : qAsConst(snapshots)) {
+            AceTreeModelPrivate::releaseSnapshot(snapshot);
+        }
     }
 
     bool RowsInsertOp::read(QDataStream &in) {
@@ -200,6 +203,8 @@ namespace Operations {
 
     RecordAddOp::~RecordAddOp() {
         delete child;
+        if (snapshot)
+            AceTreeModelPrivate::releaseSnapshot(snapshot);
     }
 
     bool RecordAddOp::read(QDataStream &in) {
@@ -265,6 +270,8 @@ namespace Operations {
 
     ElementAddOp::~ElementAddOp() {
         delete child;
+        if (snapshot)
+            AceTreeModelPrivate::releaseSnapshot(snapshot);
     }
 
     bool ElementAddOp::read(QDataStream &in) {
@@ -339,6 +346,8 @@ namespace Operations {
 
     RootChangeOp::~RootChangeOp() {
         delete newRoot;
+        if (snapshot)
+            AceTreeModelPrivate::releaseSnapshot(snapshot);
     }
 
     bool RootChangeOp::read(QDataStream &in) {
@@ -424,8 +433,12 @@ namespace Operations {
                 op->index = event->index();
 
                 const auto &children = event->children();
+                auto model_p = AceTreeModelPrivate::get(event->parent()->model());
+                op->childrenIds.reserve(children.size());
+                op->snapshots.reserve(children.size());
                 for (const auto &child : qAsConst(children)) {
-                    op->children.append(AceTreeItemPrivate::get(child)->clone_helper(false));
+                    op->childrenIds.append(child->index());
+                    op->snapshots.append(model_p->createSnapshot(child));
                 }
                 res = op;
                 break;
@@ -457,7 +470,9 @@ namespace Operations {
                 auto op = new RecordAddOp();
                 op->parent = event->parent()->index();
                 op->seq = event->sequence();
-                op->child = AceTreeItemPrivate::get(event->child())->clone_helper(false);
+                op->childId = event->child()->index();
+                op->snapshot = AceTreeModelPrivate::get(event->parent()->model())
+                                   ->createSnapshot(event->child());
                 res = op;
                 break;
             }
@@ -475,7 +490,9 @@ namespace Operations {
                 auto op = new ElementAddOp();
                 op->parent = event->parent()->index();
                 op->key = event->key();
-                op->child = AceTreeItemPrivate::get(event->child())->clone_helper(false);
+                op->childId = event->child()->index();
+                op->snapshot = AceTreeModelPrivate::get(event->parent()->model())
+                                   ->createSnapshot(event->child());
                 res = op;
                 break;
             }
@@ -492,9 +509,11 @@ namespace Operations {
                 auto event = static_cast<AceTreeRootEvent *>(e);
                 auto op = new RootChangeOp();
                 op->oldRoot = AceTreeItemPrivate::getId(event->oldRoot());
-                op->newRoot = event->root()
-                                  ? AceTreeItemPrivate::get(event->root())->clone_helper(false)
-                                  : nullptr;
+                op->newRootId = AceTreeItemPrivate::getId(event->root());
+                if (event->root()) {
+                    op->snapshot = AceTreeModelPrivate::get(event->root()->model())
+                                       ->createSnapshot(event->root());
+                }
                 res = op;
                 break;
             }
@@ -504,6 +523,46 @@ namespace Operations {
         return res;
     }
 
+    void takeSnapshots(BaseOp *baseOp) {
+        switch (baseOp->c) {
+            case RowsInsert: {
+                auto op = static_cast<RowsInsertOp *>(baseOp);
+                op->children.reserve(op->snapshots.size());
+                for (const auto &snapshot : qAsConst(op->snapshots)) {
+                    op->children.append(AceTreeModelPrivate::takeSnapshot(snapshot));
+                }
+                op->snapshots.clear();
+                break;
+            }
+            case RecordAdd: {
+                auto op = static_cast<RecordAddOp *>(baseOp);
+                if (op->snapshot) {
+                    op->child = AceTreeModelPrivate::takeSnapshot(op->snapshot);
+                    op->snapshot = nullptr;
+                }
+                break;
+            }
+            case ElementAdd: {
+                auto op = static_cast<ElementAddOp *>(baseOp);
+                if (op->snapshot) {
+                    op->child = AceTreeModelPrivate::takeSnapshot(op->snapshot);
+                    op->snapshot = nullptr;
+                }
+                break;
+            }
+            case RootChange: {
+                auto op = static_cast<RootChangeOp *>(baseOp);
+                if (op->snapshot) {
+                    op->newRoot = AceTreeModelPrivate::takeSnapshot(op->snapshot);
+                    op->snapshot = nullptr;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
     AceTreeEvent *fromOp(BaseOp *baseOp, AceTreeModel *model, bool brief) {
         AceTreeEvent *res = nullptr;
 
@@ -516,7 +575,7 @@ namespace Operations {
         switch (baseOp->c) {
             case PropertyChange: {
                 auto op = static_cast<PropertyChangeOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item) {
                     qWarning() << "[Journal] Parent not found" << op;
                     return nullptr;
@@ -528,7 +587,7 @@ namespace Operations {
             }
             case BytesReplace: {
                 auto op = static_cast<BytesReplaceOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item) {
                     qWarning() << "[Journal] Parent not found" << op;
                     return nullptr;
@@ -541,7 +600,7 @@ namespace Operations {
             case BytesInsert:
             case BytesRemove: {
                 auto op = static_cast<BytesInsertRemoveOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item) {
                     qWarning() << "[Journal] Parent not found" << op;
                     return nullptr;
@@ -554,7 +613,7 @@ namespace Operations {
             }
             case RowsInsert: {
                 auto op = static_cast<RowsInsertOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item) {
                     qWarning() << "[Journal] Parent not found" << op;
                     return nullptr;
@@ -565,7 +624,7 @@ namespace Operations {
                     // Use Brief
                     children.reserve(op->children.size());
                     for (const auto &id : qAsConst(op->childrenIds)) {
-                        auto child = model->itemFromIndex(id);
+                        auto child = model_p->findIndex(id);
                         if (!child) {
                             qWarning() << "[Journal] Child" << id << "not found" << op;
                             return nullptr;
@@ -592,7 +651,7 @@ namespace Operations {
             }
             case RowsMove: {
                 auto op = static_cast<RowsMoveOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item)
                     return nullptr;
                 auto e = new AceTreeRowsMoveEvent(AceTreeEvent::RowsMove, item, op->index,
@@ -602,7 +661,7 @@ namespace Operations {
             }
             case RowsRemove: {
                 auto op = static_cast<RowsRemoveOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item)
                     return nullptr;
 
@@ -610,7 +669,7 @@ namespace Operations {
                 QVector<AceTreeItem *> children;
                 children.reserve(op->children.size());
                 for (const auto &id : qAsConst(op->children)) {
-                    auto child = model->itemFromIndex(id);
+                    auto child = model_p->findIndex(id);
                     if (!child) {
                         qWarning() << "[Journal] Child" << id << "not found" << op;
                         return nullptr;
@@ -625,14 +684,14 @@ namespace Operations {
             }
             case RecordAdd: {
                 auto op = static_cast<RecordAddOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item)
                     return nullptr;
 
                 AceTreeItem *child;
                 if (brief) {
                     // Use brief
-                    child = model->itemFromIndex(op->childId);
+                    child = model_p->findIndex(op->childId);
                     if (!child) {
                         qWarning() << "[Journal] Child" << op->childId << "not found" << op;
                         return nullptr;
@@ -652,12 +711,12 @@ namespace Operations {
             }
             case RecordRemove: {
                 auto op = static_cast<RecordRemoveOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item)
                     return nullptr;
 
                 // Search children
-                auto child = model->itemFromIndex(op->child);
+                auto child = model_p->findIndex(op->child);
                 if (!child) {
                     qWarning() << "[Journal] Child" << op->child << "not found" << op;
                     return nullptr;
@@ -669,14 +728,14 @@ namespace Operations {
             }
             case ElementAdd: {
                 auto op = static_cast<ElementAddOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item)
                     return nullptr;
 
                 AceTreeItem *child;
                 if (brief) {
                     // Use brief
-                    child = model->itemFromIndex(op->childId);
+                    child = model_p->findIndex(op->childId);
                     if (!child) {
                         qWarning() << "[Journal] Child" << op->childId << "not found" << op;
                         return nullptr;
@@ -697,12 +756,12 @@ namespace Operations {
             }
             case ElementRemove: {
                 auto op = static_cast<ElementRemoveOp *>(baseOp);
-                auto item = model->itemFromIndex(op->parent);
+                auto item = model_p->findIndex(op->parent);
                 if (!item)
                     return nullptr;
 
                 // Search children
-                auto child = model->itemFromIndex(op->child);
+                auto child = model_p->findIndex(op->child);
                 if (!child) {
                     qWarning() << "[Journal] Child" << op->child << "not found" << op;
                     return nullptr;
@@ -716,7 +775,7 @@ namespace Operations {
                 auto op = static_cast<RootChangeOp *>(baseOp);
                 AceTreeItem *oldRoot = nullptr;
                 if (op->oldRoot != 0) {
-                    oldRoot = model->itemFromIndex(op->oldRoot);
+                    oldRoot = model_p->findIndex(op->oldRoot);
                     if (!oldRoot) {
                         qWarning() << "[Journal] Old root" << op->oldRoot << "not found" << op;
                         return nullptr;
@@ -729,7 +788,7 @@ namespace Operations {
                     if (op->newRootId == 0) {
                         newRoot = nullptr;
                     } else {
-                        newRoot = model->itemFromIndex(op->newRootId);
+                        newRoot = model_p->findIndex(op->newRootId);
                         if (!newRoot) {
                             return nullptr;
                         }
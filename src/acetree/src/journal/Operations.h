@@ -6,6 +6,8 @@
 
 #include "AceTreeEvent.h"
 
+struct AceTreeItemSnapshot;
+
 namespace Operations {
 
     Q_NAMESPACE
@@ -99,6 +101,7 @@ namespace Operations {
         int index;
         QVector<size_t> childrenIds;
         QVector<AceTreeItem *> children;
+        QVector<AceTreeItemSnapshot *> snapshots;
     };
 
     struct RowsRemoveOp : public BaseOp {
@@ -127,7 +130,9 @@ namespace Operations {
     };
 
     struct RecordAddOp : public BaseOp {
-        RecordAddOp() : BaseOp(RecordAdd), parent(0), seq(-1), childId(0), child(nullptr) {
+        RecordAddOp()
+            : BaseOp(RecordAdd), parent(0), seq(-1), childId(0), child(nullptr),
+              snapshot(nullptr) {
         }
         ~RecordAddOp();
 
@@ -140,6 +145,7 @@ namespace Operations {
         int seq;
         size_t childId;
         AceTreeItem *child;
+        AceTreeItemSnapshot *snapshot;
     };
 
     struct RecordRemoveOp : public BaseOp {
@@ -155,7 +161,8 @@ namespace Operations {
     };
 
     struct ElementAddOp : public BaseOp {
-        ElementAddOp() : BaseOp(ElementAdd), parent(0), childId(0), child(nullptr) {
+        ElementAddOp()
+            : BaseOp(ElementAdd), parent(0), childId(0), child(nullptr), snapshot(nullptr) {
         }
         ~ElementAddOp();
 
@@ -168,6 +175,7 @@ namespace Operations {
         QString key;
         size_t childId;
         AceTreeItem *child;
+        AceTreeItemSnapshot *snapshot;
     };
 
     struct ElementRemoveOp : public BaseOp {
@@ -183,7 +191,8 @@ namespace Operations {
     };
 
     struct RootChangeOp : public BaseOp {
-        RootChangeOp() : BaseOp(RootChange), oldRoot(0), newRootId(0), newRoot(nullptr) {
+        RootChangeOp()
+            : BaseOp(RootChange), oldRoot(0), newRootId(0), newRoot(nullptr), snapshot(nullptr) {
         }
         ~RootChangeOp();
 
@@ -195,10 +204,19 @@ namespace Operations {
         size_t oldRoot;
         size_t newRootId;
         AceTreeItem *newRoot;
+        AceTreeItemSnapshot *snapshot;
     };
 
+    /*
+     * Converting is cheap enough to be done in main thread, the inserted items are not
+     * copied until `takeSnapshots` is called, which is expected to be done by the worker
+     * right before the operation is written.
+     *
+     */
     BaseOp *toOp(AceTreeEvent *e);
 
+    void takeSnapshots(BaseOp *baseOp);
+
     // Will move all tree items from op to model, the op can be deleted later
     AceTreeEvent *fromOp(BaseOp *baseOp, AceTreeModel *model, bool brief);
 
@@ -1,6 +1,9 @@
 #include "Tasks.h"
 
+#include <utility>
+
 #include "AceTreeItem_p.h"
+#include "AceTreeModel_p.h"
 
 namespace Tasks {
 
@@ -21,9 +24,91 @@ namespace Tasks {
         // Delete items after writing
         delete root;
         qDeleteAll(removedItems);
+
+        // Not taken by the worker
+        if (rootSnapshot) {
+            AceTreeModelPrivate::releaseSnapshot(rootSnapshot);
+        }
+        for (const auto &snapshot : qAsConst(removedSnapshots)) {
+            AceTreeModelPrivate::releaseSnapshot(snapshot);
+        }
     }
 
     ReadCkptTask::~ReadCkptTask() {
     }
 
+    TaskQueue::TaskQueue() : tail(&stub), ahead(nullptr), stub(Sync) {
+        stub.next.store(nullptr, std::memory_order_relaxed);
+        head.store(&stub, std::memory_order_relaxed);
+    }
+
+    TaskQueue::~TaskQueue() {
+        while (auto task = pop()) {
+            delete task;
+        }
+    }
+
+    void TaskQueue::push(BaseTask *task) {
+        task->next.store(nullptr, std::memory_order_relaxed);
+        auto prev = head.exchange(task, std::memory_order_acq_rel);
+        prev->next.store(task, std::memory_order_release);
+    }
+
+    BaseTask *TaskQueue::peek() {
+        if (!ahead) {
+            ahead = take();
+        }
+        return ahead;
+    }
+
+    BaseTask *TaskQueue::pop() {
+        if (ahead) {
+            return std::exchange(ahead, nullptr);
+        }
+        return take();
+    }
+
+    bool TaskQueue::empty() const {
+        if (ahead) {
+            return false;
+        }
+        auto last = tail;
+        return !last->next.load(std::memory_order_acquire) &&
+               head.load(std::memory_order_acquire) == last;
+    }
+
+    BaseTask *TaskQueue::take() {
+        auto last = tail;
+        auto next = last->next.load(std::memory_order_acquire);
+
+        // Skip the stub
+        if (last == &stub) {
+            if (!next) {
+                return nullptr;
+            }
+            tail = next;
+            last = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            tail = next;
+            return last;
+        }
+
+        // The last one is being linked
+        if (last != head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // Put the stub back behind the last one
+        push(&stub);
+        next = last->next.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return last;
+        }
+        return nullptr;
+    }
+
 } // namespace Tasks
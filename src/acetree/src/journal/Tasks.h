@@ -1,6 +1,8 @@
 #ifndef TASKS_H
 #define TASKS_H
 
+#include <atomic>
+
 #include "Operations.h"
 
 namespace Tasks {
@@ -16,6 +18,10 @@ namespace Tasks {
         ReadAttributes,
         SwitchDirectory,
         Reset,
+        Sync,
+        Recover,
+        ReadAttributesIndex,
+        Compact,
     };
     Q_ENUM_NS(TaskType);
 
@@ -25,41 +31,55 @@ namespace Tasks {
     };
 
     struct BaseTask {
-        BaseTask(TaskType type) : t(type) {
+        BaseTask(TaskType type) : t(type), after(0) {
         }
         virtual ~BaseTask();
 
         TaskType t;
+        qint64 after; // Reading tasks wait until this many writing tasks are done
+
+        std::atomic<BaseTask *> next; // Link in TaskQueue
     };
 
     struct CommitTask : public BaseTask {
-        CommitTask() : BaseTask(Commit), fsStep(-1), fsMin(-1), maxId(0) {
+        CommitTask() : BaseTask(Commit), fsStep(-1), fsMin(-1), num(0), begin(0), maxId(0) {
         }
         ~CommitTask();
 
         OpsAndAttrs data;
         int fsStep;
         int fsMin;
+        int num;   // Segment of the step
+        int begin; // Last step before the segment
         size_t maxId;
     };
 
     struct ChangeStepTask : public BaseTask {
-        ChangeStepTask() : BaseTask(ChangeStep), fsStep(0) {
+        ChangeStepTask() : BaseTask(ChangeStep), epoch(0) {
         }
         ~ChangeStepTask();
 
-        int fsStep;
+        int epoch; // Superseded if a commit or a reset is pushed after it
     };
 
     // Writing checkpoint with root item and all items removed during last period
+    // The first task carries the snapshots, the worker copies them and keeps the task until the
+    // second one without snapshots tells it to write, when the next commit starts the segment
     struct WriteCkptTask : public BaseTask {
-        WriteCkptTask() : BaseTask(WriteCheckPoint), num(0), root(nullptr) {
+        WriteCkptTask()
+            : BaseTask(WriteCheckPoint), num(0), step(0), root(nullptr), copy(false),
+              rootSnapshot(nullptr) {
         }
         ~WriteCkptTask();
 
         int num;
+        int step; // Taken after the step
         AceTreeItem *root;
         QVector<AceTreeItem *> removedItems;
+
+        bool copy; // Carries the snapshots
+        AceTreeItemSnapshot *rootSnapshot;
+        QVector<AceTreeItemSnapshot *> removedSnapshots;
     };
 
     struct ReadCkptTask : public BaseTask {
@@ -80,13 +100,31 @@ namespace Tasks {
     };
 
     struct ReadAttributesTask : public BaseTask {
-        ReadAttributesTask() : BaseTask(ReadAttributes), step(0), buf(nullptr) {
+        ReadAttributesTask() : BaseTask(ReadAttributes), num(0), cur(0), buf(nullptr) {
+        }
+
+        int num;
+        int cur; // From 1 in the segment
+        void *buf;
+    };
+
+    // Reading attributes of all transactions in a segment
+    struct ReadAttrsIndexTask : public BaseTask {
+        ReadAttrsIndexTask() : BaseTask(ReadAttributesIndex), num(0), buf(nullptr) {
         }
 
-        int step;
+        int num;
         void *buf;
     };
 
+    // Rewriting the checkpoint of the oldest segment left after folding the earlier ones
+    struct CompactTask : public BaseTask {
+        CompactTask() : BaseTask(Compact), num(0) {
+        }
+
+        int num;
+    };
+
     struct SwitchDirTask : public BaseTask {
         SwitchDirTask() : BaseTask(SwitchDirectory), buf(nullptr) {
         }
@@ -95,6 +133,38 @@ namespace Tasks {
         void *buf;
     };
 
+    struct RecoverTask : public BaseTask {
+        RecoverTask() : BaseTask(Recover), buf(nullptr) {
+        }
+
+        void *buf;
+    };
+
+    // Lock-free intrusive queue with multiple producers and a single consumer (Vyukov's)
+    class TaskQueue {
+    public:
+        TaskQueue();
+        ~TaskQueue();
+
+        // Any thread
+        void push(BaseTask *task);
+
+        // Consumer only, a push in progress may be not visible yet
+        BaseTask *peek();
+        BaseTask *pop();
+        bool empty() const;
+
+    private:
+        BaseTask *take();
+
+        std::atomic<BaseTask *> head; // Last pushed
+        BaseTask *tail;               // Next to take
+        BaseTask *ahead;              // Taken by peek
+        BaseTask stub;
+
+        Q_DISABLE_COPY(TaskQueue)
+    };
+
 } // namespace Tasks
 
 
@@ -13,3 +13,19 @@ QVariantHash AceTreeBackend::modelInfo() const {
 void AceTreeBackend::setModelInfo(const QVariantHash &info) {
     Q_UNUSED(info);
 }
+
+QList<QHash<QString, QString>> AceTreeBackend::attributesRange(int from, int to) const {
+    QList<QHash<QString, QString>> res;
+    for (int step = from; step <= to; ++step) {
+        res.append(attributes(step));
+    }
+    return res;
+}
+
+qint64 AceTreeBackend::historyMemoryUsage() const {
+    return 0;
+}
+
+qint64 AceTreeBackend::retainedMemoryUsage() const {
+    return 0;
+}
@@ -0,0 +1,305 @@
+#include "AceTreeCompactLog_p.h"
+
+#include "AceTreeItem_p.h"
+#include "AceTreeModel_p.h"
+
+#include <cstring>
+
+namespace {
+
+    template <class T>
+    inline void put(QByteArray &code, const T &val) {
+        code.append(reinterpret_cast<const char *>(&val), sizeof(T));
+    }
+
+    struct Reader {
+        const char *p;
+
+        template <class T>
+        inline T take() {
+            T val;
+            memcpy(&val, p, sizeof(T));
+            p += sizeof(T);
+            return val;
+        }
+
+        inline void skip(int size) {
+            p += size;
+        }
+    };
+
+    inline AceTreeItem *itemFromId(AceTreeModelPrivate *model, quint64 id) {
+        if (id == 0)
+            return nullptr;
+        auto it = model->indexes.find(id);
+        if (it == model->indexes.end())
+            return nullptr;
+        return it->second;
+    }
+
+    inline quint64 idOf(const AceTreeItem *item) {
+        return AceTreeItemPrivate::getId(item);
+    }
+
+} // namespace
+
+AceTreeCompactLog::AceTreeCompactLog() {
+    m_bytes = sizeof(AceTreeCompactLog);
+}
+
+AceTreeCompactLog::~AceTreeCompactLog() {
+}
+
+void AceTreeCompactLog::append(const AceTreeEvent *e) {
+    auto size = code.size();
+    offsets.append(size);
+    put<quint8>(code, e->type());
+
+    switch (e->type()) {
+        case AceTreeEvent::PropertyChange: {
+            auto event = static_cast<const AceTreeValueEvent *>(e);
+            put<quint64>(code, idOf(event->parent()));
+            put<qint32>(code, strings.size());
+            put<qint32>(code, variants.size());
+            strings.append(event->key());
+            variants.append(event->value());
+            variants.append(event->oldValue());
+            m_bytes += AceTreeItemPrivate::entryBytes(event->key(), event->value()) +
+                       AceTreeItemPrivate::variantBytes(event->oldValue());
+            break;
+        }
+        case AceTreeEvent::BytesReplace:
+        case AceTreeEvent::BytesInsert:
+        case AceTreeEvent::BytesRemove: {
+            auto event = static_cast<const AceTreeBytesEvent *>(e);
+            put<quint64>(code, idOf(event->parent()));
+            put<qint32>(code, event->index());
+            put<qint32>(code, arrays.size());
+            arrays.append(event->bytes());
+            m_bytes += sizeof(QByteArray) + event->bytes().size();
+            if (e->type() == AceTreeEvent::BytesReplace) {
+                arrays.append(event->oldBytes());
+                m_bytes += sizeof(QByteArray) + event->oldBytes().size();
+            }
+            break;
+        }
+        case AceTreeEvent::RowsMove: {
+            auto event = static_cast<const AceTreeRowsMoveEvent *>(e);
+            put<quint64>(code, idOf(event->parent()));
+            put<qint32>(code, event->index());
+            put<qint32>(code, event->count());
+            put<qint32>(code, event->destination());
+            break;
+        }
+        case AceTreeEvent::RowsInsert:
+        case AceTreeEvent::RowsRemove: {
+            auto event = static_cast<const AceTreeRowsInsDelEvent *>(e);
+            const auto &children = event->children();
+            put<quint64>(code, idOf(event->parent()));
+            put<qint32>(code, event->index());
+            put<qint32>(code, children.size());
+            for (const auto &child : children)
+                put<quint64>(code, idOf(child));
+            break;
+        }
+        case AceTreeEvent::RecordAdd:
+        case AceTreeEvent::RecordRemove: {
+            auto event = static_cast<const AceTreeRecordEvent *>(e);
+            put<quint64>(code, idOf(event->parent()));
+            put<qint32>(code, event->sequence());
+            put<quint64>(code, idOf(event->child()));
+            break;
+        }
+        case AceTreeEvent::ElementAdd:
+        case AceTreeEvent::ElementRemove: {
+            auto event = static_cast<const AceTreeElementEvent *>(e);
+            put<quint64>(code, idOf(event->parent()));
+            put<qint32>(code, strings.size());
+            put<quint64>(code, idOf(event->child()));
+            strings.append(event->key());
+            m_bytes += sizeof(QString) + event->key().size() * qint64(sizeof(QChar));
+            break;
+        }
+        case AceTreeEvent::RootChange: {
+            auto event = static_cast<const AceTreeRootEvent *>(e);
+            put<quint64>(code, idOf(event->root()));
+            put<quint64>(code, idOf(event->oldRoot()));
+            break;
+        }
+        default:
+            break;
+    }
+
+    m_bytes += code.size() - size + qint64(sizeof(int));
+}
+
+void AceTreeCompactLog::squeeze() {
+    code.squeeze();
+    offsets.squeeze();
+    variants.squeeze();
+    arrays.squeeze();
+    strings.squeeze();
+}
+
+void AceTreeCompactLog::execute(AceTreeModelPrivate *model, bool undo) const {
+    if (undo) {
+        for (auto it = offsets.rbegin(); it != offsets.rend(); ++it) {
+            execute_helper(model, *it, true);
+        }
+    } else {
+        for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+            execute_helper(model, *it, false);
+        }
+    }
+}
+
+void AceTreeCompactLog::collect(AceTreeModelPrivate *model,
+                                QVector<AceTreeItem *> &garbage) const {
+    // Same as AceTreeEvent::clean(), find newly created items that are no longer used
+    auto removeIfManaged = [model, &garbage](quint64 id) {
+        auto item = itemFromId(model, id);
+        if (item && item->isManaged() && !item->parent())
+            garbage.append(item);
+    };
+
+    for (const auto &offset : offsets) {
+        Reader r{code.constData() + offset};
+        switch (r.take<quint8>()) {
+            case AceTreeEvent::RowsInsert: {
+                r.skip(sizeof(quint64) + sizeof(qint32));
+                auto cnt = r.take<qint32>();
+                for (int i = 0; i < cnt; ++i)
+                    removeIfManaged(r.take<quint64>());
+                break;
+            }
+            case AceTreeEvent::RecordAdd:
+            case AceTreeEvent::ElementAdd: {
+                r.skip(sizeof(quint64) + sizeof(qint32));
+                removeIfManaged(r.take<quint64>());
+                break;
+            }
+            case AceTreeEvent::RootChange: {
+                removeIfManaged(r.take<quint64>());
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void AceTreeCompactLog::execute_helper(AceTreeModelPrivate *model, int offset, bool undo) const {
+    Reader r{code.constData() + offset};
+    auto type = r.take<quint8>();
+
+    switch (type) {
+        case AceTreeEvent::PropertyChange: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            const auto &key = strings.at(r.take<qint32>());
+            auto idx = r.take<qint32>();
+            d->setProperty_helper(key, variants.at(undo ? idx + 1 : idx));
+            break;
+        }
+
+        case AceTreeEvent::BytesReplace: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            auto index = r.take<qint32>();
+            auto idx = r.take<qint32>();
+            const auto &b = arrays.at(idx);
+            if (undo) {
+                const auto &oldb = arrays.at(idx + 1);
+                d->replaceBytes_helper(index, oldb);
+
+                // Need truncate
+                int delta = b.size() - oldb.size();
+                if (delta > 0) {
+                    d->removeBytes_helper(d->byteArray.size() - delta, delta);
+                }
+            } else {
+                d->replaceBytes_helper(index, b);
+            }
+            break;
+        }
+
+        case AceTreeEvent::BytesInsert:
+        case AceTreeEvent::BytesRemove: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            auto index = r.take<qint32>();
+            const auto &b = arrays.at(r.take<qint32>());
+            ((type == AceTreeEvent::BytesRemove) ^ undo) ? d->removeBytes_helper(index, b.size())
+                                                         : d->insertBytes_helper(index, b);
+            break;
+        }
+
+        case AceTreeEvent::RowsMove: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            auto index = r.take<qint32>();
+            auto cnt = r.take<qint32>();
+            auto dest = r.take<qint32>();
+            if (undo) {
+                int r_index;
+                int r_dest;
+                if (dest > index) {
+                    r_index = dest - cnt;
+                    r_dest = index;
+                } else {
+                    r_index = dest;
+                    r_dest = index + cnt;
+                }
+                d->moveRows_helper(r_index, cnt, r_dest);
+            } else {
+                d->moveRows_helper(index, cnt, dest);
+            }
+            break;
+        }
+
+        case AceTreeEvent::RowsInsert:
+        case AceTreeEvent::RowsRemove: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            auto index = r.take<qint32>();
+            auto cnt = r.take<qint32>();
+            if ((type == AceTreeEvent::RowsRemove) ^ undo) {
+                d->removeRows_helper(index, cnt);
+            } else {
+                QVector<AceTreeItem *> children;
+                children.reserve(cnt);
+                for (int i = 0; i < cnt; ++i)
+                    children.append(itemFromId(model, r.take<quint64>()));
+                d->insertRows_helper(index, children);
+            }
+            break;
+        }
+
+        case AceTreeEvent::RecordAdd:
+        case AceTreeEvent::RecordRemove: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            auto seq = r.take<qint32>();
+            auto child = r.take<quint64>();
+            ((type == AceTreeEvent::RecordRemove) ^ undo)
+                ? d->removeRecord_helper(seq)
+                : d->addRecord_helper(seq, itemFromId(model, child));
+            break;
+        }
+
+        case AceTreeEvent::ElementAdd:
+        case AceTreeEvent::ElementRemove: {
+            auto d = AceTreeItemPrivate::get(itemFromId(model, r.take<quint64>()));
+            const auto &key = strings.at(r.take<qint32>());
+            auto child = r.take<quint64>();
+            ((type == AceTreeEvent::ElementRemove) ^ undo)
+                ? d->removeElement_helper(key)
+                : d->addElement_helper(key, itemFromId(model, child));
+            break;
+        }
+
+        case AceTreeEvent::RootChange: {
+            auto root = r.take<quint64>();
+            auto oldRoot = r.take<quint64>();
+            model->setRootItem_helper(itemFromId(model, undo ? oldRoot : root));
+            break;
+        }
+
+        default:
+            break;
+    }
+}
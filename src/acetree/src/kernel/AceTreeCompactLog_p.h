@@ -0,0 +1,48 @@
+#ifndef ACETREECOMPACTLOG_P_H
+#define ACETREECOMPACTLOG_P_H
+
+#include "AceTreeEvent.h"
+
+class AceTreeModelPrivate;
+
+/*
+ * Committed transaction stored in a contiguous buffer, each operation is an op code followed by
+ * fixed size operands. Items are referenced by index and resolved through the model, values are
+ * kept in side pools (implicitly shared, no deep copy).
+ */
+class AceTreeCompactLog {
+public:
+    AceTreeCompactLog();
+    ~AceTreeCompactLog();
+
+    void append(const AceTreeEvent *e);
+    void squeeze();
+
+    void execute(AceTreeModelPrivate *model, bool undo) const;
+    void collect(AceTreeModelPrivate *model, QVector<AceTreeItem *> &garbage) const;
+
+    inline int count() const;
+    inline qint64 bytes() const;
+
+protected:
+    QByteArray code;
+    QVector<int> offsets; // Start of each operation, to step backward
+
+    QVector<QVariant> variants;
+    QVector<QByteArray> arrays;
+    QVector<QString> strings;
+
+    qint64 m_bytes;
+
+    void execute_helper(AceTreeModelPrivate *model, int offset, bool undo) const;
+};
+
+inline int AceTreeCompactLog::count() const {
+    return offsets.size();
+}
+
+inline qint64 AceTreeCompactLog::bytes() const {
+    return m_bytes;
+}
+
+#endif // ACETREECOMPACTLOG_P_H
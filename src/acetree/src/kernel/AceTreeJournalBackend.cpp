@@ -4,14 +4,38 @@
 #include "AceTreeItem_p.h"
 #include "AceTreeModel_p.h"
 
+#include "journal/Checksum.h"
 #include "serialization/serialize_size_t.h"
 
+#include <QBuffer>
 #include <QDataStream>
 #include <QDebug>
 #include <QDir>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QTimer>
+#include <QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
 #include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 #ifndef ACETREE_ENABLE_DEBUG
 #define myDebug                                                                                    \
@@ -40,231 +64,1373 @@ static bool truncateJournals(const QString &dir, int i, bool dryRun = false) {
     bool b1 = func(QString("%1/journal_%2.dat").arg(dir, QString::number(i))) || (i == 0);
     bool b2 = func(QString("%1/ckpt_%2.dat").arg(dir, QString::number(i)));
 
+    // Index only
+    if (!dryRun) {
+        QFile::remove(QString("%1/attrs_%2.dat").arg(dir, QString::number(i)));
+    }
+
     return b1 || b2;
 };
 
-AceTreeJournalBackendPrivate::AceTreeJournalBackendPrivate() {
-    maxCheckPoints = 1;
-    worker = nullptr;
-    fsMin = fsMax = 0;
-    recoverData = nullptr;
-    writeCkptTask = nullptr;
-    backward_buf = forward_buf = nullptr;
-    stepFile = infoFile = txFile = nullptr;
-    txNum = -1;
-    fsMin2 = fsMax2 = fsStep2 = 0;
-}
+// Roles in switch.lock, the second line after the other directory
+static const char kSwitchSource[] = "source";
+static const char kSwitchTarget[] = "target";
+static const char kSwitchTargetIncremental[] = "target-incremental"; // Journal continues in target
 
-AceTreeJournalBackendPrivate::~AceTreeJournalBackendPrivate() {
-    delete recoverData;
-    delete writeCkptTask;
+static bool writeSwitchLock(const QString &dir, const QString &other, const char *role) {
+    QSaveFile file(QString("%1/switch.lock").arg(dir));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream out(&file);
+    out << other << Qt::endl << role << Qt::endl;
+    return file.commit();
+}
 
-    if (worker) {
-        worker->join();
-        delete worker;
+static bool readSwitchLock(const QString &dir, QString &other, QString &role) {
+    QFile file(QString("%1/switch.lock").arg(dir));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
     }
+    QTextStream in(&file);
+    other = in.readLine();
+    role = in.readLine(); // Empty in the older format
+    return true;
+}
 
-    delete stepFile;
-    delete infoFile;
-    delete txFile;
+// Hard link, shares the data without copying on the same file system
+static bool linkFile(const QString &from, const QString &to) {
+#ifdef Q_OS_WIN
+    return CreateHardLinkW(reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(to).utf16()),
+                           reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(from).utf16()),
+                           nullptr);
+#else
+    return ::link(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
 }
 
-void AceTreeJournalBackendPrivate::init() {
+// Replace a file at once, it is either the old one or the new one after a crash
+static bool replaceFile(const QString &from, const QString &to) {
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(from).utf16()),
+                       reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(to).utf16()),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return std::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) ==
+           0;
+#endif
 }
 
-void AceTreeJournalBackendPrivate::setup_helper() {
-    Q_Q(AceTreeJournalBackend);
-    auto model_p = AceTreeModelPrivate::get(model);
-    if (!recoverData) {
-        // Write steps
-        {
-            QFile file(QString("%1/model_steps.dat").arg(dir));
-            file.open(QIODevice::WriteOnly);
-            QDataStream out(&file);
-            setAceTreeStreamVersion(out);
-            out << maxSteps << maxCheckPoints << fsMin2 << fsMax2 << fsStep2 << model_p->maxIndex;
-        }
+static bool syncFile(QFile &file);
 
-        q->createWarningFile(dir);
-        return;
+// Copy through a temporary file, cloned if the file system supports it. The target is replaced
+// only by a complete copy on the disk.
+static bool copyFile(const QString &from, const QString &to) {
+    QFile in(from);
+    if (!in.open(QIODevice::ReadOnly)) {
+        return false;
     }
 
-    fsMin2 = fsMin = recoverData->fsMin;
-    fsMax2 = fsMax = recoverData->fsMax;
-    fsStep2 = recoverData->fsStep;
-    model_p->maxIndex = recoverData->maxId;
+    QString part = to + ".part";
+    QFile out(part);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
 
-    if (recoverData->root) {
-        model_p->setRootItem_backend(recoverData->root);
-        recoverData->root = nullptr; // Get ownership
+    bool cloned = false;
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    cloned = ::ioctl(out.handle(), FICLONE, in.handle()) == 0;
+#endif
+    bool success = true;
+    if (!cloned) {
+        QByteArray data;
+        while (!(data = in.read(1 << 20)).isEmpty()) {
+            if (out.write(data) != data.size()) {
+                success = false;
+                break;
+            }
+        }
+        success = success && in.atEnd();
     }
 
-    current = 0;
-    min = recoverData->currentNum * maxSteps;
+    // A short clone or copy is never renamed to the target
+    success = success && syncFile(out) && out.size() == in.size();
+    out.close();
+    success = success && out.error() == QFileDevice::NoError;
+    if (!success || !replaceFile(part, to)) {
+        out.remove();
+        return false;
+    }
+    return true;
+}
 
-    // Get backward transactions
-    if (!recoverData->backwardData.isEmpty()) {
-        extractBackwardJournal(recoverData->removedItems, recoverData->backwardData);
+/* Steps data (model_steps.dat)
+ *
+ * 0x0          maxSteps, steps in memory at a time, steps in a segment without segments.dat
+ * 0x4          maxCheckpoints
+ * 0x8          STP2 (older versions have the fields of a slot without sequence number here)
+ * 0xC          reserved
+ * 0x10         slot of even sequence numbers
+ * 0x30         slot of odd sequence numbers
+ *
+ * Slot
+ * 0x0          sequence number
+ * 0x4          min step in log
+ * 0x8          max step in log
+ * 0xC          current step
+ * 0x10         max index in model
+ * 0x18         checksum of the above
+ *
+ */
+
+static const char kStepsMagic[] = "STP2";
+
+static constexpr int kStepsHeaderSize = 0x10;
+static constexpr int kStepsSlotSize = 0x20;
+static constexpr int kStepsChecksumPos = 0x18;
+
+struct StepsData {
+    int maxSteps;
+    int maxCheckPoints;
+    int fsMin;
+    int fsMax;
+    int fsStep;
+    size_t maxId;
+    quint32 seq; // Sequence number of the latest slot
+    bool legacy; // Written by an older version, without slots
+};
+
+static QByteArray stepsHeader(int maxSteps, int maxCheckPoints) {
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    setAceTreeStreamVersion(out);
+    out << qint32(maxSteps) << qint32(maxCheckPoints);
+    out.writeRawData(kStepsMagic, 4);
+    out << qint32(0);
+    return data;
+}
+
+static QByteArray stepsSlot(quint32 seq, int fsMin, int fsMax, int fsStep, size_t maxId) {
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    setAceTreeStreamVersion(out);
+    out << seq << qint32(fsMin) << qint32(fsMax) << qint32(fsStep) << quint64(maxId);
+    out << Checksum::crc32c(data.constData(), data.size()) << qint32(0);
+    return data;
+}
+
+static inline qint64 stepsSlotPos(quint32 seq) {
+    return kStepsHeaderSize + (seq % 2) * kStepsSlotSize;
+}
+
+// Read the latest slot that is not torn
+static bool readStepsFile(const QString &dir, StepsData &steps) {
+    QFile file(QString("%1/model_steps.dat").arg(dir));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
     }
 
-    // Get forward transactions
-    if (!recoverData->forwardData.isEmpty()) {
-        extractForwardJournal(recoverData->forwardData);
+    QDataStream in(&file);
+    setAceTreeStreamVersion(in);
+    in >> steps.maxSteps >> steps.maxCheckPoints;
+    if (in.status() != QDataStream::Ok || steps.maxSteps <= 0) {
+        return false;
     }
 
-    int expected = fsStep2 - min;
+    if (file.peek(4) != QByteArray(kStepsMagic, 4)) {
+        in >> steps.fsMin >> steps.fsMax >> steps.fsStep >> steps.maxId;
+        steps.seq = 0;
+        steps.legacy = true;
+        return in.status() == QDataStream::Ok;
+    }
 
-    // Undo or redo
-    while (current > expected) {
-        const auto &tx = stack.at(current - 1);
-        for (auto it = tx.events.rbegin(); it != tx.events.rend(); ++it) {
-            AceTreeItemPrivate::executeEvent(*it, true);
+    bool found = false;
+    for (quint32 i = 0; i < 2; ++i) {
+        file.seek(stepsSlotPos(i));
+        auto data = file.read(kStepsSlotSize);
+        if (data.size() < kStepsSlotSize ||
+            qFromBigEndian<quint32>(data.constData() + kStepsChecksumPos) !=
+                Checksum::crc32c(data.constData(), kStepsChecksumPos)) {
+            continue;
         }
-        current--;
-    }
 
-    while (current < expected) {
-        const auto &tx = stack.at(current);
-        for (auto it = tx.events.begin(); it != tx.events.end(); ++it) {
-            AceTreeItemPrivate::executeEvent(*it, false);
+        QDataStream in2(data);
+        setAceTreeStreamVersion(in2);
+        quint32 seq;
+        in2 >> seq;
+        if (found && qint32(seq - steps.seq) < 0) {
+            continue;
         }
-        current++;
+        steps.seq = seq;
+        in2 >> steps.fsMin >> steps.fsMax >> steps.fsStep >> steps.maxId;
+        found = true;
     }
+    steps.legacy = false;
+    return found;
+}
 
-    delete recoverData;
-    recoverData = nullptr;
+// Write the whole file at once, with the steps in the slot of the sequence number
+static bool writeStepsFile(const QString &dir, const StepsData &steps) {
+    QByteArray data = stepsHeader(steps.maxSteps, steps.maxCheckPoints);
+    data.append(QByteArray(2 * kStepsSlotSize, 0));
+    data.replace(stepsSlotPos(steps.seq), kStepsSlotSize,
+                 stepsSlot(steps.seq, steps.fsMin, steps.fsMax, steps.fsStep, steps.maxId));
 
-    // Need to prepare a checkpoint to write as if a transaction has been commited
-    if (stack.size() % maxSteps == 0) {
-        writeCkptTask = genWriteCkptTask();
+    QSaveFile file(QString("%1/model_steps.dat").arg(dir));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
     }
+    file.write(data);
+    return file.commit();
 }
 
-QHash<QString, QString> AceTreeJournalBackendPrivate::fs_getAttributes(int step) const {
-    if (!worker) {
-        return fs_getAttributes_do(step);
-    }
+/* Segment index (segments.dat)
+ *
+ * 0x0          SEG1
+ * 0x4          last step before segment 0, always 0
+ * 0x8          last step before segment 1
+ * ...
+ *
+ */
 
-    auto task = new Tasks::ReadAttributesTask();
-    task->step = step;
+static const char kSegmentsMagic[] = "SEG1";
 
-    AttributesTaskBuffer buf;
-    task->buf = &buf;
+// Segment containing the step, a segment ends where the next one begins
+static int segmentOf(const QVector<int> &boundaries, int step) {
+    auto it = std::lower_bound(boundaries.begin(), boundaries.end(), step);
+    return qMax(int(it - boundaries.begin()) - 1, 0);
+}
 
-    std::unique_lock<std::mutex> lock(buf.mtx);
-    const_cast<AceTreeJournalBackendPrivate *>(this)->pushTask(task, true);
-    while (!buf.finished) {
-        buf.cv.wait(lock);
+// Read the segment index, or derive it from the fixed segment size of an older directory
+static bool readSegmentIndex(const QString &dir, int maxSteps, int fsMax, QVector<int> &boundaries) {
+    boundaries = {0};
+
+    QFile file(QString("%1/segments.dat").arg(dir));
+    if (file.open(QIODevice::ReadOnly) && file.read(4) == QByteArray(kSegmentsMagic, 4)) {
+        QDataStream in(&file);
+        setAceTreeStreamVersion(in);
+        qint32 begin;
+        in >> begin;
+        if (in.status() == QDataStream::Ok && begin == 0) {
+            // A torn entry ends the index
+            while (!in.atEnd()) {
+                in >> begin;
+                if (in.status() != QDataStream::Ok || begin <= boundaries.last()) {
+                    break;
+                }
+                boundaries.append(begin);
+            }
+            return true;
+        }
     }
-    lock.unlock();
 
-    return buf.res;
+    for (int begin = maxSteps; begin < fsMax; begin += maxSteps) {
+        boundaries.append(begin);
+    }
+    return false;
+}
+
+static bool writeSegmentIndex(const QString &dir, const QVector<int> &boundaries) {
+    QSaveFile file(QString("%1/segments.dat").arg(dir));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(kSegmentsMagic, 4);
+    QDataStream out(&file);
+    setAceTreeStreamVersion(out);
+    for (const auto &begin : boundaries) {
+        out << qint32(begin);
+    }
+    return file.commit();
 }
 
-QHash<QString, QString> AceTreeJournalBackendPrivate::fs_getAttributes_do(int step) const {
-    int num = (step - 1) / maxSteps;
+// Copy the segments that a target of an incremental switch lacks
+static void completeSwitchCopy(const QString &source, const QString &target) {
+    StepsData steps;
+    if (!readStepsFile(target, steps)) {
+        return;
+    }
 
-    QScopedPointer<QFile> file;
-    QDataStream in;
-    setAceTreeStreamVersion(in);
-    if (num == txNum && txFile && txFile->isOpen()) {
-        in.setDevice(txFile);
-    } else {
-        file.reset(new QFile(QString("%1/journal_%2.dat").arg(dir, QString::number(num))));
-        if (!file->open(QIODevice::ReadOnly)) {
-            return {};
+    QVector<int> boundaries;
+    readSegmentIndex(target, steps.maxSteps, steps.fsMax, boundaries);
+
+    int minNum = segmentOf(boundaries, steps.fsMin + 1);
+    int maxNum = boundaries.size() - 1;
+    for (int i = minNum; i <= maxNum; ++i) {
+        for (const auto &pattern : {"journal_%1.dat", "ckpt_%1.dat", "attrs_%1.dat"}) {
+            auto name = QString(pattern).arg(QString::number(i));
+            auto from = QString("%1/%2").arg(source, name);
+            auto to = QString("%1/%2").arg(target, name);
+            if (QFile::exists(from) && !QFile::exists(to) && !copyFile(from, to)) {
+                myWarning(__func__) << "copy" << from << "failed";
+            }
         }
-        in.setDevice(file.data());
     }
+}
 
-    myDebug().noquote().nospace() << "[Journal] Read attributes at " << step << " in "
-                                  << QString("%1/journal_%2.dat").arg(dir, QString::number(num));
+namespace {
+    // Maps a whole file for reading, the stream then reads from memory without system calls and
+    // the position table can be parsed in place. Falls back to the file if mapping fails.
+    class MappedFile {
+    public:
+        explicit MappedFile(QFile &file) : file(file), data(nullptr), size(file.size()) {
+            if (size > 0 && size <= std::numeric_limits<int>::max()) {
+                data = file.map(0, size);
+            }
+            if (data) {
+                raw = QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size));
+                buffer.setBuffer(&raw);
+                buffer.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+            }
+        }
 
-    auto &dev = *in.device();
-    auto pos0 = dev.pos();
+        ~MappedFile() {
+            if (data) {
+                buffer.close();
+                raw.clear();
+                file.unmap(data);
+            }
+        }
 
-    int cur = (step - 1) % maxSteps + 1;
-    if (cur == 1) {
-        dev.seek((maxSteps + 2) * sizeof(qint64)); // Data section start
-    } else {
-        dev.seek((cur - 1) * sizeof(qint64));      // Previous transaction end
-        qint64 pos;
-        in >> pos;
-        dev.seek(pos);
-    }
+        inline QIODevice *device() {
+            return data ? static_cast<QIODevice *>(&buffer) : &file;
+        }
 
-    QHash<QString, QString> res;
-    in >> res;
-    if (in.status() != QDataStream::Ok) {
-        res.clear();
+        inline bool isMapped() const {
+            return data != nullptr;
+        }
+
+        inline const uchar *constData() const {
+            return data;
+        }
+
+        inline qint64 fileSize() const {
+            return size;
+        }
+
+        inline bool contains(qint64 pos, qint64 len = 0) const {
+            return pos >= 0 && len >= 0 && pos <= size - len;
+        }
+
+        // Big endian as written by QDataStream
+        inline qint64 int64At(qint64 pos) const {
+            return qFromBigEndian<qint64>(data + pos);
+        }
+
+    private:
+        QFile &file;
+        uchar *data;
+        qint64 size;
+        QByteArray raw;
+        QBuffer buffer;
+    };
+} // namespace
+
+static const char kJournalMagic[] = "JRN2";
+static const char kCheckPointMagic[] = "CKP4";
+static const char kCheckPointMagicV3[] = "CKP3";
+static const char kCheckPointMagicV2[] = "CKP2";
+static const char kAttributesMagic[] = "ATR1";
+
+static constexpr int kJournalHeaderSize = 8;
+
+// Space reserved at once for an append-only journal
+static constexpr qint64 kJournalChunkSize = 1024 * 1024;
+static constexpr int kCheckPointHeaderSize = 24;
+static constexpr int kRecordHeaderSize = 12;
+static constexpr qint64 kParallelVerifyBytes = 1 << 20;
+static constexpr qint64 kParallelCheckPointBytes = 1 << 20;
+static constexpr double kPrefetchSeconds = 2;
+static constexpr int kMaxPrefetchSegments = 4;
+
+namespace {
+    // Passes written data to a device and computes the checksum on the way
+    class ChecksumDevice : public QIODevice {
+    public:
+        explicit ChecksumDevice(QIODevice *dev) : dev(dev), crc(0) {
+            open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+        }
+
+        quint32 takeChecksum() {
+            auto res = crc;
+            crc = 0;
+            return res;
+        }
+
+    protected:
+        qint64 readData(char *data, qint64 maxlen) override {
+            Q_UNUSED(data);
+            Q_UNUSED(maxlen);
+            return -1;
+        }
+
+        qint64 writeData(const char *data, qint64 len) override {
+            auto res = dev->write(data, len);
+            if (res > 0) {
+                crc = Checksum::crc32c(data, res, crc);
+            }
+            return res;
+        }
+
+    private:
+        QIODevice *dev;
+        quint32 crc;
+    };
+
+    struct JournalRecord {
+        qint64 pos; // Header position
+        qint32 step;
+        qint32 len; // Negative for a truncation mark
+        quint32 crc;
+    };
+} // namespace
+
+// Checksum of a record covers the step, the size and the data
+static quint32 recordChecksum(qint32 step, qint32 len, const char *data) {
+    uchar header[8];
+    qToBigEndian<qint32>(step, header);
+    qToBigEndian<qint32>(len, header + 4);
+    auto crc = Checksum::crc32c(header, sizeof(header));
+    return len > 0 ? Checksum::crc32c(data, len, crc) : crc;
+}
+
+// Checksum of a range, read from the mapping if possible
+static quint32 rangeChecksum(MappedFile &mapped, qint64 begin, qint64 end) {
+    if (mapped.isMapped()) {
+        return Checksum::crc32c(mapped.constData() + begin, end - begin);
     }
 
-    // Restore pos
-    dev.seek(pos0);
-    return res;
+    auto &dev = *mapped.device();
+    dev.seek(begin);
+    quint32 crc = 0;
+    while (begin < end) {
+        auto data = dev.read(qMin<qint64>(end - begin, kParallelVerifyBytes));
+        if (data.isEmpty()) {
+            break;
+        }
+        crc = Checksum::crc32c(data.constData(), data.size(), crc);
+        begin += data.size();
+    }
+    return crc;
 }
 
-bool AceTreeJournalBackendPrivate::readJournal(QFile &file, int maxSteps,
-                                               QVector<Tasks::OpsAndAttrs> &res, bool brief) {
-    QDataStream in(&file);
-    setAceTreeStreamVersion(in);
-    QList<qint64> positions{
-        static_cast<qint64>((maxSteps + 2) * sizeof(qint64)),
+// Returns the number of leading records that match their checksums, mapped records are checked by
+// several threads
+static int verifyRecords(MappedFile &mapped, const QVector<JournalRecord> &records) {
+    auto check = [&mapped](const JournalRecord &r) {
+        auto data = reinterpret_cast<const char *>(mapped.constData()) + r.pos + kRecordHeaderSize;
+        return recordChecksum(r.step, r.len, data) == r.crc;
     };
 
-    qint64 cnt;
-    in >> cnt;
+    int n = records.size();
+    if (!mapped.isMapped()) {
+        auto &dev = *mapped.device();
+        for (int i = 0; i < n; ++i) {
+            const auto &r = records.at(i);
+            QByteArray data;
+            if (r.len > 0) {
+                dev.seek(r.pos + kRecordHeaderSize);
+                data = dev.read(r.len);
+                if (data.size() != r.len) {
+                    return i;
+                }
+            }
+            if (recordChecksum(r.step, r.len, data.constData()) != r.crc) {
+                return i;
+            }
+        }
+        return n;
+    }
 
-    if (cnt < 0 || cnt > std::numeric_limits<int>::max()) {
-        in.setStatus(QDataStream::ReadCorruptData);
-        return false;
+    qint64 total = n > 0 ? records.last().pos - records.first().pos : 0;
+    int threads = int(qMin<qint64>(std::thread::hardware_concurrency(),
+                                   total / kParallelVerifyBytes + 1));
+    threads = qBound(1, threads, qMax(n, 1));
+
+    // First damaged record of each range
+    std::vector<int> damaged(threads, -1);
+    auto verifyRange = [&](int t) {
+        int end = int(qint64(n) * (t + 1) / threads);
+        for (int i = int(qint64(n) * t / threads); i < end; ++i) {
+            if (!check(records.at(i))) {
+                damaged[t] = i;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(verifyRange, t);
+    }
+    verifyRange(0);
+    for (auto &thread : pool) {
+        thread.join();
     }
 
-    positions.reserve(static_cast<qsizetype>(cnt));
-    for (qint64 i = 0; i < cnt - 1; ++i) {
-        qint64 pos;
-        in >> pos;
-        positions.append(pos);
+    for (const auto &i : damaged) {
+        if (i >= 0) {
+            return i;
+        }
     }
+    return n;
+}
 
-    if (in.status() != QDataStream::Ok) {
-        return false;
+static QByteArray compressData(int codec, const QByteArray &data) {
+    switch (codec) {
+        case AceTreeJournalBackend::ZlibCompression:
+            return qCompress(data);
+        default:
+            break;
     }
+    return data;
+}
 
-    QVector<Tasks::OpsAndAttrs> data;
-    data.reserve(static_cast<qsizetype>(cnt));
-    for (const auto &pos : qAsConst(positions)) {
-        file.seek(pos);
+// Returns an empty array if failed
+static QByteArray uncompressData(int codec, const QByteArray &data) {
+    switch (codec) {
+        case AceTreeJournalBackend::NoCompression:
+            return data;
+        case AceTreeJournalBackend::ZlibCompression:
+            return qUncompress(data);
+        default:
+            break;
+    }
+    return {};
+}
 
-        qDebug() << "Read transaction at position" << pos;
+static QByteArray codecHeader(const char *magic, int codec) {
+    QByteArray header(magic, 4);
+    header.resize(8);
+    qToBigEndian<quint32>(codec, header.data() + 4);
+    return header;
+}
 
-        // Read attributes
-        QHash<QString, QString> attrs;
-        in >> attrs;
+// Append-only segments start with a magic and the codec, older ones with the position table
+static bool isAppendJournal(QIODevice &dev, int *codec = nullptr,
+                            const char *magic = kJournalMagic) {
+    dev.seek(0);
+    auto header = dev.read(kJournalHeaderSize);
+    if (header.size() != kJournalHeaderSize || !header.startsWith(magic)) {
+        return false;
+    }
+    if (codec) {
+        *codec = int(qFromBigEndian<quint32>(header.constData() + 4));
+    }
+    return true;
+}
 
-        qDebug() << "Read transaction at position" << in.device()->pos();
+// Get payload position of each transaction in an append-only segment, stops at a torn record or at
+// a damaged one if verifying. Returns the end of the last accepted record.
+static qint64 scanJournal(QIODevice &dev, QVector<qint64> &positions,
+                          MappedFile *verify = nullptr, QVector<qint32> *sizes = nullptr) {
+    QDataStream in(&dev);
+    setAceTreeStreamVersion(in);
 
-        // Read operations
-        qint32 op_cnt;
-        in >> op_cnt;
-        if (op_cnt < 0) {
-            in.setStatus(QDataStream::ReadCorruptData);
-            goto failed;
+    // Read headers
+    QVector<JournalRecord> records;
+    auto size = dev.size();
+    qint64 pos = kJournalHeaderSize;
+    int count = 0;
+    while (pos + kRecordHeaderSize <= size) {
+        dev.seek(pos);
+        JournalRecord r;
+        r.pos = pos;
+        in >> r.step >> r.len >> r.crc;
+        if (in.status() != QDataStream::Ok || r.step < 1 || r.step > count + 1) {
+            break;
         }
-        QVector<Operations::BaseOp *> ops;
-        ops.reserve(static_cast<qsizetype>(op_cnt));
-        for (int i = 0; i < op_cnt; ++i) {
-            bool success = false;
-            Operations::Change c;
-            in >> c;
 
-            Operations::BaseOp *baseOp = nullptr;
-            switch (c) {
-                case Operations::PropertyChange: {
-                    auto op = new Operations::PropertyChangeOp();
-                    success = op->read(in);
-                    baseOp = op;
-                    break;
+        qint64 len = qMax(r.len, 0);
+        if (pos + kRecordHeaderSize + len > size) {
+            break; // Torn record
+        }
+        records.append(r);
+        count = r.step - (r.len < 0 ? 1 : 0);
+        pos += kRecordHeaderSize + len;
+    }
+
+    if (verify) {
+        int valid = verifyRecords(*verify, records);
+        if (valid < records.size()) {
+            pos = records.at(valid).pos;
+            records.resize(valid);
+        }
+    }
+
+    // A record of a step discards the ones of the same and later steps before it
+    positions.clear();
+    if (sizes) {
+        sizes->clear();
+    }
+    for (const auto &r : qAsConst(records)) {
+        positions.resize(r.step - 1);
+        if (r.len >= 0) {
+            positions.append(r.pos + kRecordHeaderSize);
+        }
+        if (sizes) {
+            sizes->resize(r.step - 1);
+            if (r.len >= 0) {
+                sizes->append(r.len);
+            }
+        }
+    }
+    return pos;
+}
+
+// Check the sections of a checkpoint to read, in parallel if both
+static bool verifyCheckPoint(MappedFile &mapped, qint64 pos, const quint32 *rootCrc,
+                             const quint32 *removedCrc) {
+    const qint64 rootBegin = kCheckPointHeaderSize;
+    const qint64 end = mapped.fileSize();
+    if (pos < rootBegin || pos > end) {
+        return false;
+    }
+
+    bool removedValid = true;
+    std::thread thread;
+    if (removedCrc) {
+        auto checkRemoved = [&]() {
+            removedValid = rangeChecksum(mapped, pos, end) == *removedCrc;
+        };
+        if (rootCrc && mapped.isMapped()) {
+            thread = std::thread(checkRemoved);
+        } else {
+            checkRemoved();
+        }
+    }
+
+    bool rootValid = !rootCrc || rangeChecksum(mapped, rootBegin, pos) == *rootCrc;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    return rootValid && removedValid;
+}
+
+// Runs the function for each index on several threads, a thread takes the next index when done
+static void parallelFor(int count, const std::function<void(int)> &func) {
+    int threads = qMin(int(std::thread::hardware_concurrency()), count);
+    if (threads <= 1) {
+        for (int i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next(0);
+    auto run = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            func(i);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(run);
+    }
+    run();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+}
+
+// Serialize items concurrently into buffers, returns empty if they are too small to split
+static std::vector<QByteArray> serializeItems(const QVector<AceTreeItem *> &items) {
+    qint64 total = 0;
+    for (const auto &item : items) {
+        total += AceTreeItemPrivate::get(item)->subtreeBytes;
+    }
+    if (items.size() < 2 || total < kParallelCheckPointBytes) {
+        return {};
+    }
+
+    // Larger ones first to balance the threads
+    QVector<int> order(items.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&items](int a, int b) {
+        return AceTreeItemPrivate::get(items.at(a))->subtreeBytes >
+               AceTreeItemPrivate::get(items.at(b))->subtreeBytes;
+    });
+
+    std::vector<QByteArray> buffers(items.size());
+    parallelFor(items.size(), [&](int k) {
+        int i = order.at(k);
+        QDataStream out(&buffers[i], QIODevice::WriteOnly);
+        setAceTreeStreamVersion(out);
+        AceTreeItemPrivate::get(items.at(i))->write_helper(out, false);
+    });
+    return buffers;
+}
+
+// Smallest and largest index in the subtree
+static QPair<size_t, size_t> indexRange(const AceTreeItem *item) {
+    auto d = AceTreeItemPrivate::get(item);
+    if (d->stub) {
+        return {d->stub->minIndex, d->stub->maxIndex};
+    }
+
+    QPair<size_t, size_t> res{d->m_index, d->m_index};
+    auto merge = [&res](const AceTreeItem *child) {
+        auto range = indexRange(child);
+        res.first = qMin(res.first, range.first);
+        res.second = qMax(res.second, range.second);
+    };
+    for (const auto &child : qAsConst(d->vector))
+        merge(child);
+    for (const auto &child : qAsConst(d->records))
+        merge(child);
+    for (const auto &child : qAsConst(d->set))
+        merge(child);
+    return res;
+}
+
+// Write the root with its direct children serialized concurrently, followed by the offset, size and
+// index range of each child in the section so that they can be read concurrently as well, and a
+// lazily read child is only loaded for the indexes it has. The device must start at the section.
+static void writeSplitRoot(QDataStream &out, const AceTreeItem *root) {
+    auto d = AceTreeItemPrivate::get(root);
+    auto &dev = *out.device();
+
+    // Direct children in the order of write_helper
+    QVector<AceTreeItem *> children = d->vector;
+    for (auto it = d->records.begin(); it != d->records.end(); ++it) {
+        children.append(it.value());
+    }
+    for (auto it = d->set.begin(); it != d->set.end(); ++it) {
+        children.append(it.value());
+    }
+
+    QVector<QPair<qint64, qint64>> table;
+    auto buffers = serializeItems(children);
+    if (buffers.empty()) {
+        d->write_helper(out, false);
+    } else {
+        table.reserve(children.size());
+        d->write_helper(out, false, [&](QDataStream &stream, const AceTreeItem *) {
+            const auto &buf = buffers.at(table.size());
+            table.append({dev.pos(), buf.size()});
+            stream.writeRawData(buf.constData(), buf.size());
+        });
+    }
+
+    // Write table
+    qint64 pos = dev.pos();
+    out << qint32(table.size());
+    for (int i = 0; i < table.size(); ++i) {
+        const auto &entry = table.at(i);
+        auto range = indexRange(children.at(i));
+        out << entry.first << entry.second << quint64(range.first) << quint64(range.second);
+    }
+    out << pos;
+}
+
+// Read the root written by writeSplitRoot, the listed children are read concurrently first and
+// linked when the root reaches them, or left as stubs in lazy mode. The stream must be at the root
+// data of the section. Tables without index ranges make stubs covering any index.
+static AceTreeItem *readSplitRoot(QDataStream &in, const QByteArray &section, bool ranged,
+                                  bool lazy) {
+    auto data = section.constData();
+    qint64 size = section.size();
+
+    // Read table
+    if (size < qint64(sizeof(qint32) + sizeof(qint64))) {
+        return nullptr;
+    }
+    auto tablePos = qFromBigEndian<qint64>(data + size - sizeof(qint64));
+    if (tablePos < 0 || tablePos > size - qint64(sizeof(qint32) + sizeof(qint64))) {
+        return nullptr;
+    }
+    const qint64 entrySize = (ranged ? 4 : 2) * sizeof(qint64);
+    auto n = qFromBigEndian<qint32>(data + tablePos);
+    if (n < 0 ||
+        tablePos + qint64(sizeof(qint32)) + n * entrySize + qint64(sizeof(qint64)) != size) {
+        return nullptr;
+    }
+    if (n == 0) {
+        return AceTreeItemPrivate::read_helper(in, false);
+    }
+
+    QVector<QPair<qint64, qint64>> table;
+    QVector<QPair<size_t, size_t>> ranges;
+    table.reserve(n);
+    ranges.reserve(n);
+    auto p = data + tablePos + sizeof(qint32);
+    for (int i = 0; i < n; ++i, p += entrySize) {
+        auto offset = qFromBigEndian<qint64>(p);
+        auto len = qFromBigEndian<qint64>(p + sizeof(qint64));
+        if (offset < 0 || len < 0 || offset > tablePos - len) {
+            return nullptr;
+        }
+        table.append({offset, len});
+        if (ranged) {
+            ranges.append({size_t(qFromBigEndian<quint64>(p + 2 * sizeof(qint64))),
+                           size_t(qFromBigEndian<quint64>(p + 3 * sizeof(qint64)))});
+        } else {
+            ranges.append({0, std::numeric_limits<size_t>::max()});
+        }
+    }
+
+    std::vector<AceTreeItem *> children(n, nullptr);
+    if (lazy) {
+        for (int i = 0; i < n; ++i) {
+            const auto &entry = table.at(i);
+            const auto &range = ranges.at(i);
+            children[i] =
+                AceTreeItemPrivate::createStub(section, int(entry.first), int(entry.second),
+                                               in.version(), range.first, range.second);
+        }
+    } else {
+        parallelFor(n, [&](int i) {
+            const auto &entry = table.at(i);
+            auto bytes = QByteArray::fromRawData(data + entry.first, int(entry.second));
+            QDataStream stream(bytes);
+            setAceTreeStreamVersion(stream);
+            children[i] = AceTreeItemPrivate::read_helper(stream, false);
+        });
+    }
+
+    int next = 0;
+    auto root = AceTreeItemPrivate::read_helper(in, false, [&](QDataStream &stream) {
+        if (next >= n) {
+            return static_cast<AceTreeItem *>(nullptr);
+        }
+        const auto &entry = table.at(next);
+        if (!children[next] || stream.device()->pos() != entry.first ||
+            stream.skipRawData(int(entry.second)) != entry.second) {
+            return static_cast<AceTreeItem *>(nullptr);
+        }
+        return std::exchange(children[next++], nullptr);
+    });
+    if (root && next != n) {
+        delete root;
+        root = nullptr;
+    }
+
+    // Children not linked to the root
+    for (const auto &child : children) {
+        delete child;
+    }
+    return root;
+}
+
+// Get start position of each transaction from the head table of an older segment
+static bool readPositionTable(MappedFile &mapped, int maxSteps, QVector<qint64> &positions) {
+    auto &dev = *mapped.device();
+    dev.seek(0);
+
+    QDataStream in(&dev);
+    setAceTreeStreamVersion(in);
+
+    qint64 cnt;
+    in >> cnt;
+
+    if (in.status() != QDataStream::Ok || cnt < 0 || cnt > std::numeric_limits<int>::max()) {
+        return false;
+    }
+
+    positions.clear();
+    positions.reserve(static_cast<int>(cnt));
+    positions.append((maxSteps + 2) * sizeof(qint64)); // Data section start
+    if (mapped.isMapped()) {
+        // Parse in place
+        if (!mapped.contains(0, cnt * qint64(sizeof(qint64)))) {
+            return false;
+        }
+        for (qint64 i = 1; i < cnt; ++i) {
+            auto pos = mapped.int64At(i * sizeof(qint64));
+            if (!mapped.contains(pos)) {
+                return false;
+            }
+            positions.append(pos);
+        }
+    } else {
+        for (qint64 i = 0; i < cnt - 1; ++i) {
+            qint64 pos;
+            in >> pos;
+            positions.append(pos);
+        }
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+// Write at the position with a single call, bypassing the buffer of the file
+static bool writeAt(QFile &file, qint64 pos, const QByteArray &data) {
+#if defined(Q_OS_WIN)
+    OVERLAPPED ov = {};
+    ov.Offset = DWORD(pos);
+    ov.OffsetHigh = DWORD(pos >> 32);
+    DWORD written;
+    return WriteFile(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle())), data.constData(),
+                     DWORD(data.size()), &written, &ov) &&
+           written == DWORD(data.size());
+#else
+    return pwrite(file.handle(), data.constData(), data.size(), pos) == data.size();
+#endif
+}
+
+// Reserve space up to the size, the file size stays as it is on all platforms so that readers
+// never see a zero-filled tail, returns false if not supported
+static bool preallocateFile(QFile &file, qint64 size) {
+    if (!file.flush())
+        return false;
+#if defined(Q_OS_WIN)
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    return SetFileInformationByHandle(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle())),
+                                      FileAllocationInfo, &info, sizeof(info));
+#elif defined(Q_OS_MAC)
+    fstore_t store = {F_ALLOCATEALL, F_PEOFPOSMODE, 0, size - file.size(), 0};
+    return store.fst_length <= 0 || fcntl(file.handle(), F_PREALLOCATE, &store) != -1;
+#elif defined(Q_OS_LINUX)
+    return fallocate(file.handle(), FALLOC_FL_KEEP_SIZE, 0, size) == 0;
+#else
+    Q_UNUSED(size);
+    return false; // posix_fallocate extends the file
+#endif
+}
+
+static bool syncFile(QFile &file) {
+    if (!file.flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle())));
+#elif defined(Q_OS_MAC)
+    return fcntl(file.handle(), F_FULLFSYNC) == 0 || fsync(file.handle()) == 0;
+#else
+    return fdatasync(file.handle()) == 0;
+#endif
+}
+
+AceTreeJournalBackendPrivate::AceTreeJournalBackendPrivate() {
+    maxCheckPoints = 1;
+    compactThreshold = 0;
+    segmentSteps = 0;
+    segmentBytes = 0;
+    legacySegments = 0;
+    openBytes = 0;
+    openBytesBegin = openBytesStep = -1;
+    durability = AceTreeJournalBackend::Flush;
+    syncInterval = 1000;
+    syncScheduled = false;
+    worker = nullptr;
+    copier = nullptr;
+    workerSleeping = false;
+    workerQuit = false;
+    ring = nullptr;
+    reader = nullptr;
+    readerQuit = false;
+    pushedWrites = barrierWrites = doneWrites = 0;
+    fsMin = fsMax = 0;
+    boundaries = boundaries2 = {0};
+    recoverData = nullptr;
+    recoverBuf = nullptr;
+    writeCkptStep = -1;
+    heldCkpt = nullptr;
+    undoRate = redoRate = 0;
+    stepFile = infoFile = segmentsFile = txFile = attrsFile = ckptFile = nullptr;
+    txNum = -1;
+    txAppend = false;
+    txEnd = txAllocated = 0;
+    txCodec = AceTreeJournalBackend::NoCompression;
+    compression = AceTreeJournalBackend::NoCompression;
+    lazyLoading = false;
+    ioUring = true;
+    lostSteps = {0, 0};
+    fsMin2 = fsMax2 = fsStep2 = 0;
+    maxId2 = 0;
+    stepsSeq = 0;
+    stepsPending = false;
+    latestStep = stepEpoch = 0;
+    stepQueued = false;
+}
+
+AceTreeJournalBackendPrivate::~AceTreeJournalBackendPrivate() {
+    delete recoverData;
+
+    // Pending tasks are done before the worker quits
+    if (worker) {
+        {
+            std::lock_guard<std::mutex> lock(parkMtx);
+            workerQuit = true;
+        }
+        parkCv.notify_one();
+        worker->join();
+        delete worker;
+    }
+
+    // Reads wait for writes, join it after the writing worker
+    if (reader) {
+        {
+            std::lock_guard<std::mutex> lock(readMtx);
+            readerQuit = true;
+        }
+        readCv.notify_one();
+        reader->join();
+        delete reader;
+    }
+
+    // Copying left is done by the next recovery
+    if (copier) {
+        {
+            std::lock_guard<std::mutex> lock(switchCopy.mtx);
+            switchCopy.quit = true;
+        }
+        copier->join();
+        delete copier;
+    }
+
+    // Recovered but not taken
+    delete recoverBuf;
+
+    // Prefetched but not taken
+    qDeleteAll(backward_bufs);
+    qDeleteAll(forward_bufs);
+
+    // Steps may be not written in PeriodicSync mode
+    if (stepsPending) {
+        syncJournal();
+    }
+
+    if (txFile) {
+        closeJournal();
+    }
+
+    delete stepFile;
+    delete infoFile;
+    delete segmentsFile;
+    delete txFile;
+    delete attrsFile;
+    delete ckptFile;
+}
+
+void AceTreeJournalBackendPrivate::init() {
+}
+
+void AceTreeJournalBackendPrivate::setup_helper() {
+    Q_Q(AceTreeJournalBackend);
+    auto model_p = AceTreeModelPrivate::get(model);
+    if (!recoverData) {
+        // Write steps
+        maxId2 = model_p->maxIndex;
+        writeStepsFile(dir, {maxSteps, maxCheckPoints, fsMin2, fsMax2, fsStep2, maxId2, 0, false});
+
+        // Write segment index
+        boundaries2 = boundaries = {0};
+        writeSegmentIndex(dir, boundaries);
+
+        q->createWarningFile(dir);
+        return;
+    }
+
+    fsMin2 = fsMin = recoverData->fsMin;
+    fsMax2 = fsMax = recoverData->fsMax;
+    fsStep2 = recoverData->fsStep;
+    maxId2 = model_p->maxIndex = recoverData->maxId;
+    stepsSeq = recoverData->stepsSeq;
+
+    if (recoverData->root) {
+        model_p->setRootItem_backend(recoverData->root);
+        recoverData->root = nullptr; // Get ownership
+    }
+
+    boundaries2 = boundaries = recoverData->boundaries;
+    legacySegments = recoverData->legacySegments;
+
+    current = 0;
+    min = boundaries.at(recoverData->currentNum);
+
+    // Get backward transactions
+    if (!recoverData->backwardData.isEmpty()) {
+        extractBackwardJournal(recoverData->removedItems, recoverData->backwardData);
+    }
+
+    // Get forward transactions
+    if (!recoverData->forwardData.isEmpty()) {
+        extractForwardJournal(recoverData->forwardData);
+    }
+
+    int expected = fsStep2 - min;
+
+    // Undo or redo
+    while (current > expected) {
+        execute(stack.at(current - 1), true);
+        current--;
+    }
+
+    while (current < expected) {
+        execute(stack.at(current), false);
+        current++;
+    }
+
+    delete recoverData;
+    recoverData = nullptr;
+
+    // Need to prepare a checkpoint to write as if a transaction has been commited
+    if (min + current == fsMax && isSegmentFull()) {
+        pushWriteCkptTask();
+    }
+}
+
+bool AceTreeJournalBackendPrivate::isSegmentFull() {
+    if (current == 0) {
+        return false;
+    }
+
+    // Segments of an older directory keep the position table of the fixed size
+    int begin = boundaries.last();
+    int step = min + current;
+    int limit =
+        (boundaries.size() <= legacySegments || segmentSteps <= 0) ? maxSteps : segmentSteps;
+    if (step - begin >= limit) {
+        return true;
+    }
+    if (segmentBytes <= 0) {
+        return false;
+    }
+
+    if (openBytesBegin != begin || openBytesStep != step - 1) {
+        openBytes = 0;
+        for (int i = qMax(begin - min, 0); i < current - 1; ++i) {
+            openBytes += stack.at(i).bytes;
+        }
+    }
+    openBytes += stack.at(current - 1).bytes;
+    openBytesBegin = begin;
+    openBytesStep = step;
+    return openBytes >= segmentBytes;
+}
+
+QHash<QString, QString> AceTreeJournalBackendPrivate::fs_getAttributes(int step) const {
+    int num = segmentOf(boundaries, step);
+    int cur = step - boundaries.at(num);
+    if (!worker) {
+        return fs_getAttributes_do(num, cur);
+    }
+
+    auto task = new Tasks::ReadAttributesTask();
+    task->num = num;
+    task->cur = cur;
+
+    AttributesTaskBuffer buf;
+    task->buf = &buf;
+
+    std::unique_lock<std::mutex> lock(buf.mtx);
+    const_cast<AceTreeJournalBackendPrivate *>(this)->pushTask(task, true);
+    while (!buf.finished) {
+        buf.cv.wait(lock);
+    }
+    lock.unlock();
+
+    return buf.res;
+}
+
+QHash<QString, QString> AceTreeJournalBackendPrivate::fs_getCachedAttributes(int step) const {
+    int num = segmentOf(boundaries, step);
+    int cur = step - boundaries.at(num) - 1;
+
+    // Read the whole segment again if the step was not written when cached
+    auto it = attrsCache.find(num);
+    if (it == attrsCache.end() || cur >= it->size()) {
+        it = attrsCache.insert(num, fs_getAttributesIndex(num));
+    }
+    if (cur < it->size()) {
+        return it->at(cur);
+    }
+    return fs_getAttributes(step);
+}
+
+QVector<QHash<QString, QString>>
+    AceTreeJournalBackendPrivate::fs_getAttributesIndex(int num) const {
+    if (!worker) {
+        return fs_getAttributesIndex_do(num);
+    }
+
+    auto task = new Tasks::ReadAttrsIndexTask();
+    task->num = num;
+
+    AttributesIndexTaskBuffer buf;
+    task->buf = &buf;
+
+    std::unique_lock<std::mutex> lock(buf.mtx);
+    const_cast<AceTreeJournalBackendPrivate *>(this)->pushTask(task, true);
+    while (!buf.finished) {
+        buf.cv.wait(lock);
+    }
+    lock.unlock();
+
+    return std::move(buf.res);
+}
+
+QVector<QHash<QString, QString>>
+    AceTreeJournalBackendPrivate::fs_getAttributesIndex_do(int num) const {
+    QVector<QHash<QString, QString>> res;
+    auto dir1 = readDir();
+    const_cast<AceTreeJournalBackendPrivate *>(this)->claimSwitchSegment(num, true);
+
+    // Read the sidecar index
+    {
+        QFile file(QString("%1/attrs_%2.dat").arg(dir1, QString::number(num)));
+        if (file.open(QIODevice::ReadOnly)) {
+            MappedFile mapped(file);
+            auto &dev = *mapped.device();
+            if (isAppendJournal(dev, nullptr, kAttributesMagic)) {
+                QVector<qint64> positions;
+                scanJournal(dev, positions, &mapped);
+
+                QDataStream in(&dev);
+                setAceTreeStreamVersion(in);
+
+                res.reserve(positions.size());
+                for (const auto &pos : qAsConst(positions)) {
+                    dev.seek(pos);
+                    QHash<QString, QString> attrs;
+                    in >> attrs;
+                    if (in.status() != QDataStream::Ok) {
+                        break;
+                    }
+                    res.append(attrs);
+                }
+            }
+        }
+    }
+
+    myDebug().noquote().nospace() << "[Journal] Read attributes index of segment " << num
+                                  << ", size=" << res.size();
+
+    if (!res.isEmpty()) {
+        return res;
+    }
+
+    // Not indexed, read the journal at once
+    QFile file(QString("%1/journal_%2.dat").arg(dir1, QString::number(num)));
+    QVector<Tasks::OpsAndAttrs> data;
+    if (file.open(QIODevice::ReadOnly) && readJournal(file, maxSteps, data, true)) {
+        res.reserve(data.size());
+        for (auto &item : data) {
+            res.append(item.attributes);
+            qDeleteAll(item.operations);
+        }
+    }
+    return res;
+}
+
+QHash<QString, QString> AceTreeJournalBackendPrivate::fs_getAttributes_do(int num,
+                                                                          int cur) const {
+    const_cast<AceTreeJournalBackendPrivate *>(this)->claimSwitchSegment(num, true);
+
+    // The journal being written is owned by the writing worker, open another one
+    auto path = QString("%1/journal_%2.dat").arg(readDir(), QString::number(num));
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    QDataStream in(&file);
+    setAceTreeStreamVersion(in);
+
+    myDebug().noquote().nospace() << "[Journal] Read attributes at " << cur << " in " << path;
+
+    auto &dev = file;
+
+    int codec;
+    QByteArray payload;
+    QBuffer buffer;
+    if (isAppendJournal(dev, &codec)) {
+        QVector<qint64> positions;
+        QVector<qint32> sizes;
+        scanJournal(dev, positions, nullptr, &sizes);
+        if (cur > positions.size()) {
+            return {};
+        }
+        dev.seek(positions.at(cur - 1));
+
+        // Read from the uncompressed record
+        if (codec != AceTreeJournalBackend::NoCompression) {
+            payload = uncompressData(codec, dev.read(sizes.at(cur - 1)));
+            buffer.setBuffer(&payload);
+            buffer.open(QIODevice::ReadOnly);
+            in.setDevice(&buffer);
+        }
+    } else if (cur == 1) {
+        dev.seek((maxSteps + 2) * sizeof(qint64)); // Data section start
+    } else {
+        dev.seek((cur - 1) * sizeof(qint64));      // Previous transaction end
+        qint64 pos;
+        in >> pos;
+        dev.seek(pos);
+    }
+
+    QHash<QString, QString> res;
+    in >> res;
+    if (in.status() != QDataStream::Ok) {
+        res.clear();
+    }
+    return res;
+}
+
+bool AceTreeJournalBackendPrivate::readJournal(QFile &file, int maxSteps,
+                                               QVector<Tasks::OpsAndAttrs> &res, bool brief) {
+    MappedFile mapped(file);
+    auto &dev = *mapped.device();
+
+    QDataStream in(&dev);
+    setAceTreeStreamVersion(in);
+
+    int codec = AceTreeJournalBackend::NoCompression;
+    QVector<qint64> positions;
+    QVector<qint32> sizes;
+    if (isAppendJournal(dev, &codec)) {
+        scanJournal(dev, positions, &mapped, &sizes);
+    } else if (!readPositionTable(mapped, maxSteps, positions)) {
+        return false;
+    }
+
+    QByteArray payload;
+    QBuffer buffer;
+
+    QVector<Tasks::OpsAndAttrs> data;
+    data.reserve(positions.size());
+    for (int k = 0; k < positions.size(); ++k) {
+        auto pos = positions.at(k);
+        dev.seek(pos);
+
+        // Read from the uncompressed record
+        if (codec != AceTreeJournalBackend::NoCompression) {
+            buffer.close();
+            payload = uncompressData(codec, dev.read(sizes.at(k)));
+            if (payload.isEmpty()) {
+                goto failed;
+            }
+            buffer.setBuffer(&payload);
+            buffer.open(QIODevice::ReadOnly);
+            in.setDevice(&buffer);
+        }
+
+        // Read attributes
+        QHash<QString, QString> attrs;
+        in >> attrs;
+
+        // Read operations
+        qint32 op_cnt;
+        in >> op_cnt;
+        if (op_cnt < 0) {
+            in.setStatus(QDataStream::ReadCorruptData);
+            goto failed;
+        }
+        QVector<Operations::BaseOp *> ops;
+        ops.reserve(static_cast<qsizetype>(op_cnt));
+        for (int i = 0; i < op_cnt; ++i) {
+            bool success = false;
+            Operations::Change c;
+            in >> c;
+
+            Operations::BaseOp *baseOp = nullptr;
+            switch (c) {
+                case Operations::PropertyChange: {
+                    auto op = new Operations::PropertyChangeOp();
+                    success = op->read(in);
+                    baseOp = op;
+                    break;
                 }
                 case Operations::BytesReplace: {
                     auto op = new Operations::BytesReplaceOp();
@@ -326,539 +1492,1467 @@ bool AceTreeJournalBackendPrivate::readJournal(QFile &file, int maxSteps,
                     baseOp = op;
                     break;
                 }
-                case Operations::RootChange: {
-                    auto op = new Operations::RootChangeOp();
-                    success = brief ? op->readBrief(in) : op->read(in);
-                    baseOp = op;
+                case Operations::RootChange: {
+                    auto op = new Operations::RootChangeOp();
+                    success = brief ? op->readBrief(in) : op->read(in);
+                    baseOp = op;
+                    break;
+                }
+                default:
+                    break;
+            }
+            ops.append(baseOp);
+
+            if (!success) {
+                qDeleteAll(ops);
+                goto failed;
+            }
+        }
+
+        data.append({ops, attrs});
+    }
+
+    res = std::move(data);
+    return true;
+
+failed:
+    for (const auto &item : qAsConst(data)) {
+        qDeleteAll(item.operations);
+    }
+    return false;
+}
+
+bool AceTreeJournalBackendPrivate::readCheckPoint(QFile &file, AceTreeItem **rootRef,
+                                                  QVector<AceTreeItem *> *removedItemsRef,
+                                                  bool lazy) {
+    MappedFile mapped(file);
+    auto &dev = *mapped.device();
+
+    QDataStream in(&dev);
+    setAceTreeStreamVersion(in);
+    auto magic = dev.read(4);
+    bool ranged = magic == QByteArray(kCheckPointMagic, 4);
+    bool split = ranged || magic == kCheckPointMagicV3;
+    bool checked = split || magic == kCheckPointMagicV2;
+
+    AceTreeItem *root = nullptr;
+    QVector<AceTreeItem *> removedItems;
+
+    // Read removed items pos
+    qint64 pos;
+    in >> pos;
+
+    // Verify sections to read
+    qint64 rootBegin = 4 + sizeof(qint64);
+    quint32 codec = AceTreeJournalBackend::NoCompression;
+    if (checked) {
+        quint32 rootCrc;
+        quint32 removedCrc;
+        in >> rootCrc >> removedCrc >> codec;
+        if (in.status() != QDataStream::Ok ||
+            !verifyCheckPoint(mapped, pos, rootRef ? &rootCrc : nullptr,
+                              removedItemsRef ? &removedCrc : nullptr)) {
+            myWarning(__func__).noquote() << file.fileName() << "is damaged";
+            return false;
+        }
+        rootBegin = kCheckPointHeaderSize;
+    }
+
+    // Sections are compressed independently
+    QByteArray section;
+    QBuffer buffer;
+    auto openSection = [&](qint64 begin, qint64 end) {
+        dev.seek(begin);
+        buffer.close();
+        if (codec == AceTreeJournalBackend::NoCompression) {
+            in.setDevice(&dev);
+            return true;
+        }
+        section = uncompressData(codec, dev.read(end - begin));
+        buffer.setBuffer(&section);
+        buffer.open(QIODevice::ReadOnly);
+        in.setDevice(&buffer);
+        return !section.isEmpty();
+    };
+
+    if (rootRef) {
+        if (!openSection(rootBegin, pos)) {
+            return false;
+        }
+
+        // The subtree table is addressed in the section, stubs keep a copy of it
+        if (split && codec == AceTreeJournalBackend::NoCompression) {
+            section = (mapped.isMapped() && !lazy)
+                          ? QByteArray::fromRawData(
+                                reinterpret_cast<const char *>(mapped.constData()) + rootBegin,
+                                int(pos - rootBegin))
+                          : dev.read(pos - rootBegin);
+            buffer.setBuffer(&section);
+            buffer.open(QIODevice::ReadOnly);
+            in.setDevice(&buffer);
+        }
+
+        // Read root id
+        size_t id;
+        in >> id;
+        if (id != 0) {
+            // Read root
+            root = split ? readSplitRoot(in, section, ranged, lazy)
+                         : AceTreeItemPrivate::read_helper(in, false);
+            if (!root) {
+                myDebug() << "[Journal] read root failed";
+                return false;
+            }
+        }
+    }
+
+    if (removedItemsRef) {
+        if (!openSection(pos, mapped.fileSize())) {
+            delete root;
+            return false;
+        }
+
+        // Read removed items size
+        qint32 sz;
+        in >> sz;
+        if (sz < 0) {
+            delete root;
+            return false;
+        }
+
+        // Read removed items data
+        removedItems.reserve(sz);
+        for (int i = 0; i < sz; ++i) {
+            auto item = AceTreeItemPrivate::read_helper(in, false);
+            if (!item) {
+                delete root;
+                qDeleteAll(removedItems);
+                return false;
+            }
+            removedItems.append(item);
+        }
+    }
+
+    if (root)
+        *rootRef = root;
+
+    if (removedItemsRef)
+        *removedItemsRef = std::move(removedItems);
+
+    return true;
+}
+
+bool AceTreeJournalBackendPrivate::writeCheckPoint(QIODevice &file, AceTreeItem *root,
+                                                   const QVector<AceTreeItem *> &removedItems,
+                                                   int codec) {
+    file.write(kCheckPointMagic, 4);
+    QDataStream out(&file);
+    setAceTreeStreamVersion(out);
+    out << qint64(0) << quint32(0) << quint32(0) << quint32(codec);
+
+    // Returns the checksum of the written section
+    auto writeSection = [&file, codec](const std::function<void(QDataStream &)> &func) {
+        if (codec == AceTreeJournalBackend::NoCompression) {
+            // Compute checksum while writing
+            ChecksumDevice dev(&file);
+            QDataStream out2(&dev);
+            setAceTreeStreamVersion(out2);
+            func(out2);
+            return dev.takeChecksum();
+        }
+
+        QByteArray data;
+        {
+            QDataStream out2(&data, QIODevice::WriteOnly);
+            setAceTreeStreamVersion(out2);
+            func(out2);
+        }
+        data = compressData(codec, data);
+        file.write(data);
+        return Checksum::crc32c(data.constData(), data.size());
+    };
+
+    auto rootCrc = writeSection([root](QDataStream &out) {
+        if (root) {
+            // Write index
+            out << root->index();
+
+            // Write root data
+            writeSplitRoot(out, root);
+        } else {
+            // Write 0
+            out << size_t(0);
+        }
+    });
+
+    qint64 pos = file.pos();
+
+    auto removedCrc = writeSection([&removedItems](QDataStream &out) {
+        // Write removed items size
+        out << qint32(removedItems.size());
+
+        // Write removed items data
+        auto buffers = serializeItems(removedItems);
+        if (buffers.empty()) {
+            for (const auto &item : qAsConst(removedItems)) {
+                AceTreeItemPrivate::get(item)->write_helper(out, false);
+            }
+        } else {
+            for (const auto &buf : buffers) {
+                out.writeRawData(buf.constData(), buf.size());
+            }
+        }
+    });
+
+    // Write removed items pos and checksums
+    file.seek(4);
+    out << pos << rootCrc << removedCrc;
+    return out.status() == QDataStream::Ok;
+}
+
+void AceTreeJournalBackendPrivate::pushWriteCkptTask() {
+    // Items are copied by the worker, the same way as the inserted items of commits
+    auto model_p = AceTreeModelPrivate::get(model);
+
+    // Collect all removed items
+    QVector<AceTreeItemSnapshot *> removedSnapshots;
+    for (int i = qMax(boundaries.last() - min, 0); i != stack.size(); ++i) {
+        const auto &tx = stack.at(i);
+        for (const auto &e : qAsConst(tx.events)) {
+            switch (e->type()) {
+                case AceTreeEvent::RowsRemove: {
+                    auto event = static_cast<AceTreeRowsInsDelEvent *>(e);
+                    const auto &children = event->children();
+                    for (const auto &child : children) {
+                        removedSnapshots.append(model_p->createSnapshot(child));
+                    }
+                    break;
+                }
+
+                case AceTreeEvent::RecordRemove: {
+                    auto event = static_cast<AceTreeRecordEvent *>(e);
+                    removedSnapshots.append(model_p->createSnapshot(event->child()));
+                    break;
+                }
+
+                case AceTreeEvent::ElementRemove: {
+                    auto event = static_cast<AceTreeElementEvent *>(e);
+                    removedSnapshots.append(model_p->createSnapshot(event->child()));
+                    break;
+                }
+
+                case AceTreeEvent::RootChange: {
+                    auto event = static_cast<AceTreeRootEvent *>(e);
+                    if (event->oldRoot())
+                        removedSnapshots.append(model_p->createSnapshot(event->oldRoot()));
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    auto task = new Tasks::WriteCkptTask();
+    task->num = boundaries.size();
+    task->step = min + stack.size();
+    task->copy = true;
+    task->removedSnapshots = std::move(removedSnapshots);
+    if (auto root = model->rootItem()) {
+        task->rootSnapshot = model_p->createSnapshot(root);
+    }
+    writeCkptStep = task->step;
+    pushTask(task);
+}
+
+void AceTreeJournalBackendPrivate::updateStackSize() {
+    // Keep twice the prefetch window in each direction, segments are evicted as a whole
+    int keepBackward = 2 * prefetchSegments(undoRate) * maxSteps;
+    int keepForward = 2 * prefetchSegments(redoRate) * maxSteps;
+
+    int size = 0;
+    int first = segmentOf(boundaries, min + 1);
+    if (current > keepBackward + maxSteps / 2) {
+        for (int i = first; i < boundaries.size() - 1; ++i) {
+            int end = boundaries.at(i + 1) - min;
+            if (end > current - keepBackward + maxSteps / 2) {
+                break;
+            }
+            size = end;
+        }
+    } else if (maxBytes > 0 && current > keepBackward &&
+               historyBytes + retainedBytes > maxBytes) {
+        // The memory budget is a soft limit here
+        if (first < boundaries.size() - 1 && boundaries.at(first + 1) - min < current) {
+            size = boundaries.at(first + 1) - min;
+        }
+    }
+
+    if (size > 0) {
+        // Abort backward transactions reading tasks
+        abortBackwardReadTasks();
+
+        // Remove head
+        removeEvents(0, size, true);
+        min += size;
+        current -= size;
+
+        myDebug().noquote().nospace()
+            << "[Journal] Remove backward transactions, size=" << size << ", min=" << min
+            << ", current=" << current << ", stack_size=" << stack.size();
+    }
+
+    if (stack.size() - current > keepForward + maxSteps / 2) {
+        // Cut at the end of the segment containing the last step to keep
+        auto it = std::lower_bound(boundaries.begin(), boundaries.end(),
+                                   min + current + keepForward);
+        int end = it == boundaries.end() ? stack.size() : *it - min;
+        if (end < stack.size()) {
+            // Abort forward transactions reading tasks
+            abortForwardReadTasks();
+
+            // Remove tail
+            size = stack.size() - end;
+            removeEvents(end, stack.size(), true);
+
+            myDebug().noquote().nospace()
+                << "[Journal] Remove forward transactions, size=" << size << ", min=" << min
+                << ", current=" << current << ", stack_size=" << stack.size();
+        }
+    }
+}
+
+bool AceTreeJournalBackendPrivate::acceptChangeMaxSteps(int steps) const {
+    return !recoverData && AceTreeMemBackendPrivate::acceptChangeMaxSteps(steps);
+}
+
+bool AceTreeJournalBackendPrivate::acceptCompactHistory() const {
+    // Checkpoints are generated from the events
+    return false;
+}
+
+void AceTreeJournalBackendPrivate::afterModelInfoSet() {
+    auto task = new Tasks::UpdateModelInfoTask();
+    task->info = modelInfo;
+    pushTask(task);
+}
+
+void AceTreeJournalBackendPrivate::afterCommit(const QList<AceTreeEvent *> &events,
+                                               const QHash<QString, QString> &attributes) {
+    // Update fsMax
+    fsMax = min + current;
+
+    // Segments after the new step are overwritten
+    boundaries.resize(segmentOf(boundaries, fsMax) + 1);
+    legacySegments = qMin(legacySegments, boundaries.size());
+
+    // Start a new segment if the previous commit filled the last one
+    bool ckpt = false;
+    if (writeCkptStep >= 0 && writeCkptStep == fsMax - 1) {
+        boundaries.append(writeCkptStep);
+        ckpt = true;
+    }
+    writeCkptStep = -1;
+
+    int num = boundaries.size() - 1;
+
+    // Update fsMin
+    int expectMin;
+    if (maxCheckPoints >= 0 && num > maxCheckPoints + 3 &&
+        (expectMin = qMin(boundaries.at(num - (maxCheckPoints + 3)), min)) > fsMin) {
+        fsMin = expectMin;
+    }
+
+    // Fold the older half of segments into a base checkpoint, never below the stack
+    int compactNum = -1;
+    if (compactThreshold > 0) {
+        int minNum = segmentOf(boundaries, fsMin + 1);
+        int base = qMin(num - compactThreshold / 2, segmentOf(boundaries, min + 1));
+        if (num - minNum >= compactThreshold && base > minNum) {
+            fsMin = boundaries.at(base);
+            compactNum = base;
+
+            // Segments to read backward are gone
+            abortBackwardReadTasks();
+            for (auto it = attrsCache.begin(); it != attrsCache.end();) {
+                if (it.key() < base) {
+                    it = attrsCache.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    // Cached attributes of this segment and later ones are outdated
+    for (auto it = attrsCache.begin(); it != attrsCache.end();) {
+        if (it.key() >= num) {
+            it = attrsCache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Abort forward transactions reading task
+    abortForwardReadTasks();
+
+    // Abort backward transactions reading task
+    if (current > maxSteps * 1.5)
+        abortBackwardReadTasks();
+
+    // Write the checkpoint kept by the worker
+    if (ckpt) {
+        auto task = new Tasks::WriteCkptTask();
+        task->num = num;
+        task->step = boundaries.last();
+        pushTask(task);
+    }
+
+    // Add commit task (Must do it after writing checkpoint)
+    // The operations only reference inserted items, which will be copied by the worker
+    {
+        QVector<Operations::BaseOp *> ops;
+        ops.reserve(events.size());
+        bool needUpdateIdx = false;
+        for (const auto &event : events) {
+            ops.append(Operations::toOp(event));
+            switch (event->type()) {
+                case AceTreeEvent::RowsInsert:
+                case AceTreeEvent::RecordAdd:
+                case AceTreeEvent::ElementAdd:
+                case AceTreeEvent::RootChange:
+                    needUpdateIdx = true;
                     break;
-                }
                 default:
                     break;
             }
-            ops.append(baseOp);
+        }
+        supersedeStepTasks();
 
-            if (!success) {
-                qDeleteAll(ops);
-                goto failed;
-            }
+        auto task = new Tasks::CommitTask();
+        task->data = {std::move(ops), attributes};
+        task->fsStep = fsMax;
+        task->fsMin = fsMin;
+        task->num = num;
+        task->begin = boundaries.last();
+        if (needUpdateIdx) {
+            task->maxId = AceTreeModelPrivate::get(model)->maxIndex;
         }
+        pushTask(task);
+    }
 
-        data.append({ops, attrs});
+    // The commit truncates the folded segments first
+    if (compactNum > 0) {
+        auto task = new Tasks::CompactTask();
+        task->num = compactNum;
+        pushTask(task);
     }
 
-    res = std::move(data);
-    return true;
+    // Copy the checkpoint now, written when the next commit starts a new segment
+    if (isSegmentFull()) {
+        pushWriteCkptTask();
+    }
 
-failed:
-    for (const auto &item : qAsConst(data)) {
-        qDeleteAll(item.operations);
+    updateStackSize();
+}
+
+void AceTreeJournalBackendPrivate::afterReset() {
+    fsMin = 0;
+    fsMax = 0;
+    boundaries = {0};
+    legacySegments = 0;
+    attrsCache.clear();
+
+    writeCkptStep = -1;
+
+    abortForwardReadTasks();
+    abortBackwardReadTasks();
+
+    supersedeStepTasks();
+
+    auto task = new Tasks::BaseTask(Tasks::Reset);
+    pushTask(task);
+}
+
+void AceTreeJournalBackendPrivate::supersedeStepTasks() {
+    // Queued step changes are older than the next write of steps
+    std::lock_guard<std::mutex> lock(stepMtx);
+    ++stepEpoch;
+    stepQueued = false;
+}
+
+static void abortReadTasks(QList<AceTreeJournalBackendPrivate::CheckPointTaskBuffer *> &bufs) {
+    for (const auto &buf : qAsConst(bufs)) {
+        std::unique_lock<std::mutex> lock(buf->mtx);
+        if (buf->finished) {
+            lock.unlock();
+            delete buf;
+        } else {
+            buf->obsolete = true; // Deleted by worker
+        }
     }
-    return false;
+    bufs.clear();
 }
 
-bool AceTreeJournalBackendPrivate::readCheckPoint(QFile &file, AceTreeItem **rootRef,
-                                                  QVector<AceTreeItem *> *removedItemsRef) {
-    QDataStream in(&file);
-    setAceTreeStreamVersion(in);
-    in.skipRawData(4);
+void AceTreeJournalBackendPrivate::abortBackwardReadTasks() {
+    abortReadTasks(backward_bufs);
+}
 
-    AceTreeItem *root = nullptr;
-    QVector<AceTreeItem *> removedItems;
+void AceTreeJournalBackendPrivate::abortForwardReadTasks() {
+    abortReadTasks(forward_bufs);
+}
 
-    if (!rootRef) {
-        // Read removed items pos
-        qint64 pos;
-        in >> pos;
-        file.seek(pos);
+int AceTreeJournalBackendPrivate::prefetchSegments(double rate) const {
+    // Enough segments for the steps to go through in a while at the rate
+    return qBound(1, 1 + int(rate * kPrefetchSeconds / maxSteps), kMaxPrefetchSegments);
+}
+
+void AceTreeJournalBackendPrivate::updateStepRate(bool undo) {
+    double rate = 0;
+    if (stepTimer.isValid()) {
+        auto elapsed = stepTimer.restart();
+        if (elapsed < 1000) {
+            rate = 1000.0 / qMax(elapsed, qint64(1));
+        }
     } else {
-        // Skip removed items pos
-        in.skipRawData(sizeof(qint64));
+        stepTimer.start();
+    }
 
-        // Read root id
-        size_t id;
-        in >> id;
-        if (id != 0) {
-            // Read root
-            root = AceTreeItemPrivate::read_helper(in, false);
-            if (!root) {
-                myDebug() << "[Journal] read root failed";
-                return false;
-            }
+    // Moving average in the direction of travel, the other direction fades out
+    auto &cur = undo ? undoRate : redoRate;
+    auto &other = undo ? redoRate : undoRate;
+    cur = rate > 0 ? cur * 0.7 + rate * 0.3 : 0;
+    other *= 0.5;
+}
+
+void AceTreeJournalBackendPrivate::prefetchBackward(int segments) {
+    // Segments are read from the nearest one
+    int first = segmentOf(boundaries, min + 1);
+    int num = first - 1 - backward_bufs.size();
+    int last = qMax(first - segments, segmentOf(boundaries, fsMin + 1));
+    for (; num >= last; --num) {
+        auto task = new Tasks::ReadCkptTask();
+        task->num = num;
+
+        // Allocate buffer
+        auto buf = new CheckPointTaskBuffer();
+        buf->brief = true;
+        task->buf = buf;
+        backward_bufs.append(buf);
+
+        pushTask(task);
+    }
+}
+
+void AceTreeJournalBackendPrivate::prefetchForward(int segments) {
+    int first = segmentOf(boundaries, min + stack.size() + 1);
+    int num = first + forward_bufs.size();
+    int last = qMin(first + segments - 1, boundaries.size() - 1);
+    for (; num <= last; ++num) {
+        auto task = new Tasks::ReadCkptTask();
+        task->num = num;
+
+        // Allocate buffer
+        auto buf = new CheckPointTaskBuffer();
+        task->buf = buf;
+        forward_bufs.append(buf);
+
+        pushTask(task);
+    }
+}
+
+void AceTreeJournalBackendPrivate::takeBackwardReadTasks(bool wait) {
+    // Insert finished segments in order, wait for the nearest one if required
+    while (!backward_bufs.isEmpty()) {
+        auto buf = backward_bufs.first();
+        std::unique_lock<std::mutex> lock(buf->mtx);
+        if (wait) {
+            buf->cv.wait(lock, [buf]() {
+                return buf->finished; //
+            });
+            wait = false;
+        }
+        if (!buf->finished) {
+            break;
+        }
+        lock.unlock();
+        backward_bufs.removeFirst();
+
+        myDebug().noquote().nospace()
+            << "[Journal] Prepend backward transactions, size=" << buf->data.size();
+
+        extractBackwardJournal(buf->removedItems, buf->data);
+        delete buf;
+    }
+}
+
+void AceTreeJournalBackendPrivate::takeForwardReadTasks(bool wait) {
+    while (!forward_bufs.isEmpty()) {
+        auto buf = forward_bufs.first();
+        std::unique_lock<std::mutex> lock(buf->mtx);
+        if (wait) {
+            buf->cv.wait(lock, [buf]() {
+                return buf->finished; //
+            });
+            wait = false;
+        }
+        if (!buf->finished) {
+            break;
+        }
+        lock.unlock();
+        forward_bufs.removeFirst();
+
+        myDebug().noquote().nospace()
+            << "[Journal] Append forward transactions, size=" << buf->data.size();
+
+        extractForwardJournal(buf->data);
+        delete buf;
+    }
+}
+
+void AceTreeJournalBackendPrivate::extractBackwardJournal(QVector<AceTreeItem *> &removedItems,
+                                                          QVector<Tasks::OpsAndAttrs> &data) {
+    int size = data.size();
+
+    // Extrack transactions
+    QVector<TransactionData> stack1;
+    stack1.reserve(size);
+
+    auto model_p = AceTreeModelPrivate::get(model);
+
+    // Add removed items to model
+    for (const auto &item : qAsConst(removedItems)) {
+        model_p->addManagedItem_backend(item);
+    }
+
+    // Get ownership
+    removedItems.clear();
+
+    for (const auto &item : qAsConst(data)) {
+        TransactionData tx;
+        tx.log = nullptr;
+        tx.events.reserve(item.operations.size());
+        for (const auto &op : item.operations) {
+            auto e = Operations::fromOp(op, model, true);
+            tx.events.append(e);
+        }
+        tx.attrs = item.attributes;
+        measure(tx);
+        stack1.append(tx);
+    }
+
+    stack = stack1 + stack;
+    min -= size;
+    current += size;
+}
+
+void AceTreeJournalBackendPrivate::extractForwardJournal(QVector<Tasks::OpsAndAttrs> &data) {
+    auto size = data.size();
+
+    // Extrack transactions
+    QVector<TransactionData> stack1;
+    stack1.reserve(size);
+
+    for (const auto &item : qAsConst(data)) {
+        TransactionData tx;
+        tx.log = nullptr;
+        tx.events.reserve(item.operations.size());
+        for (const auto &op : item.operations) {
+            auto e = Operations::fromOp(op, model, false);
+            tx.events.append(e);
+        }
+        tx.attrs = item.attributes;
+        measure(tx);
+        stack1.append(tx);
+    }
+
+    stack += stack1;
+}
+
+void AceTreeJournalBackendPrivate::beforeCurrentChange(bool undo) {
+    updateStepRate(undo);
+
+    // Block only if the step to go is not loaded yet
+    if (undo) {
+        if (current == 0 && fsMin < min) {
+            if (backward_bufs.isEmpty())
+                prefetchBackward(1);
+            takeBackwardReadTasks(true);
+        }
+    } else if (current == stack.size() && fsMax > min + stack.size()) {
+        if (forward_bufs.isEmpty())
+            prefetchForward(1);
+        takeForwardReadTasks(true);
+    }
+}
+
+void AceTreeJournalBackendPrivate::afterCurrentChange() {
+    Q_Q(AceTreeJournalBackend);
+
+    // Push step updating task, a queued one takes the step when written
+    {
+        std::unique_lock<std::mutex> lock(stepMtx);
+        latestStep = q->current();
+        if (!stepQueued) {
+            stepQueued = true;
+
+            auto task = new Tasks::ChangeStepTask();
+            task->epoch = stepEpoch;
+            lock.unlock();
+            pushTask(task);
+        }
+    }
+
+    // Keep segments ahead in both directions, more in the direction of travel
+    if (fsMin < min) {
+        int segments = prefetchSegments(undoRate);
+        if (current <= (segments - 1) * maxSteps + maxSteps / 2) {
+            prefetchBackward(segments);
         }
+        // Wait only at the boundary, otherwise the step range would look exhausted
+        takeBackwardReadTasks(current == 0);
     }
 
-    if (removedItemsRef) {
-        // Read removed items size
-        qint32 sz;
-        in >> sz;
-        if (sz < 0) {
-            delete root;
-            return false;
-        }
+    if (fsMax > min + stack.size()) {
+        int segments = prefetchSegments(redoRate);
+        if (stack.size() - current < (segments - 1) * maxSteps + maxSteps / 2) {
+            prefetchForward(segments);
+        }
+        takeForwardReadTasks(current == stack.size());
+    }
+
+    // Over
+    updateStackSize();
+}
+
+/* Checkpoint data (ckpt_XXX.dat)
+ *
+ * 0x0          CKP4 (CKP3 without the index ranges, CKP2 without the subtree table, CKPT without
+ *              checksums and codec)
+ * 0x4          removed items pos
+ * 0xC          root section checksum
+ * 0x10         removed items section checksum
+ * 0x14         codec
+ * 0x18         root id (0 if null)
+ * 0x20         root data
+ * 0xM          subtree table (count, offset, size and index range of each direct child of root in
+ *              the section)
+ * 0xM+N        subtree table pos in the section
+ * 0xN          removed items size
+ * 0xN+4        removed items data
+ *
+ * Each section is compressed as a whole if the codec is not none, the checksums cover the stored
+ * data.
+ *
+ */
+
+/* Transaction data (journal_XXX.dat), append-only
+ *
+ * 0x0              JRN2
+ * 0x4              codec
+ * 0x8              record (step in segment, size, CRC-32C, transaction data)
+ * ...
+ *
+ * A record of step k discards all records of steps >= k before it, a negative size marks a
+ * truncation without data. The checksum covers the step, the size and the data, reading stops at a
+ * torn or damaged record. Transaction data is compressed independently if the codec is not none.
+ *
+ */
+
+/* Transaction data (journal_XXX.dat), older segments with a head position table
+ *
+ * 0x8              max entries
+ * 0x10             entry 1
+ * 0x18             entry 2
+ * ...
+ * 8*maxStep        entry maxStep
+ * 8*maxStep+8      0xFFFFFFFFFFFFFFFF
+ * 8*maxStep+16     transaction 0 (attributes + operations)
+ * ...
+ *
+ */
+
+void AceTreeJournalBackendPrivate::writeBatch(const QVector<Tasks::BaseTask *> &batch) {
+    int oldMin = fsMin2;
+    int oldCount = boundaries2.size();
 
-        // Read removed items data
-        removedItems.reserve(sz);
-        for (int i = 0; i < sz; ++i) {
-            auto item = AceTreeItemPrivate::read_helper(in, false);
-            if (!item) {
-                delete root;
-                qDeleteAll(removedItems);
-                return false;
-            }
-            removedItems.append(item);
-        }
-    }
+    bool committed = false;
+    bool stepped = false;
+    size_t maxId = 0;
 
-    if (root)
-        *rootRef = root;
+    // Write transactions
+    {
+        auto &file = *txFile;
+        QDataStream out(&file);
+        setAceTreeStreamVersion(out);
+
+        QByteArray records;          // Records to append
+        QByteArray attrRecords;      // Records to append to the attributes index
+        QMap<int, qint64> positions; // Position table entries to update
+        qint64 end = -1;
+        int last = 0;
+
+        for (const auto &cur_task : batch) {
+            if (cur_task->t == Tasks::ChangeStep) {
+                // Take the latest step, unless a later commit has superseded it
+                std::lock_guard<std::mutex> lock(stepMtx);
+                if (static_cast<Tasks::ChangeStepTask *>(cur_task)->epoch == stepEpoch) {
+                    fsStep2 = latestStep;
+                    stepQueued = false;
+                    stepped = true;
+                }
+                continue;
+            }
 
-    if (removedItemsRef)
-        *removedItemsRef = std::move(removedItems);
+            auto task = static_cast<Tasks::CommitTask *>(cur_task);
+            fsMin2 = task->fsMin;
+            fsMax2 = task->fsStep;
+            fsStep2 = task->fsStep;
+            if (task->maxId > 0) {
+                maxId = task->maxId;
+            }
 
-    return true;
-}
+            // All commits in a batch share the same file
+            if (!committed) {
+                committed = true;
 
-bool AceTreeJournalBackendPrivate::writeCheckPoint(QFile &file, AceTreeItem *root,
-                                                   const QVector<AceTreeItem *> &removedItems) {
-    file.write("CKPT", 4);
-    QDataStream out(&file);
-    setAceTreeStreamVersion(out);
-    out << qint64(0);
-    if (root) {
-        // Write index
-        out << root->index();
+                if (!file.isOpen() || txNum != task->num) {
+                    txNum = task->num;
 
-        // Write root data
-        AceTreeItemPrivate::get(root)->write_helper(out, false);
-    } else {
-        // Write 0
-        out << size_t(0);
-    }
+                    // The old file may be still pending to sync
+                    if (file.isOpen() && durability == AceTreeJournalBackend::PeriodicSync) {
+                        syncFile(file);
+                    }
 
-    // Write removed items pos
-    qint64 pos = file.pos();
-    file.seek(4);
-    out << pos;
-    file.seek(pos);
+                    // A new segment or one continued after undoing
+                    if (boundaries2.size() != txNum + 1 || boundaries2.last() != task->begin) {
+                        boundaries2.resize(txNum);
+                        boundaries2.append(task->begin);
+                        writeSegmentEntry(txNum, task->begin);
+                    }
 
-    // Write removed items size
-    out << qint32(removedItems.size());
+                    // Reopen file
+                    closeJournal();
+                    file.setFileName(QString("%1/journal_%2.dat").arg(dir, QString::number(txNum)));
+                    claimSwitchFile(QFileInfo(file).fileName());
 
-    // Write removed items data
-    for (const auto &item : qAsConst(removedItems)) {
-        AceTreeItemPrivate::get(item)->write_helper(out, false);
-    }
-    return true;
-}
+                    file.open(QIODevice::ReadWrite);
 
-Tasks::WriteCkptTask *AceTreeJournalBackendPrivate::genWriteCkptTask() const {
-    // Collect all removed items
-    QVector<AceTreeItem *> removedItems;
-    for (int i = stack.size() - maxSteps; i != stack.size(); ++i) {
-        const auto &tx = stack.at(i);
-        for (const auto &e : qAsConst(tx.events)) {
-            switch (e->type()) {
-                case AceTreeEvent::RowsRemove: {
-                    auto event = static_cast<AceTreeRowsInsDelEvent *>(e);
-                    const auto &children = event->children();
-                    for (const auto &child : children) {
-                        removedItems.append(AceTreeItemPrivate::get(child)->clone_helper(false));
+                    if (file.size() < kJournalHeaderSize) {
+                        // New segments are append-only
+                        file.resize(0);
+                        file.write(codecHeader(kJournalMagic, compression));
+                        if (ring) {
+                            file.flush(); // Records are written to the descriptor
+                        }
+                        txAppend = true;
+                        txCodec = compression;
+                        txEnd = kJournalHeaderSize;
+                    } else {
+                        // Older segments keep the position table, existing ones keep the codec
+                        txAppend = isAppendJournal(file, &txCodec);
+                        if (txAppend) {
+                            // Drop a zero-filled or torn tail left by an older version or a crash
+                            QVector<qint64> positions;
+                            txEnd = scanJournal(file, positions);
+                            if (file.size() > txEnd) {
+                                file.resize(txEnd);
+                            }
+                            file.seek(txEnd);
+                        }
                     }
-                    break;
-                }
+                    txAllocated = file.size();
 
-                case AceTreeEvent::RecordRemove: {
-                    auto event = static_cast<AceTreeRecordEvent *>(e);
-                    removedItems.append(
-                        AceTreeItemPrivate::get(event->child())->clone_helper(false));
-                    break;
+                    openAttributesIndex(txNum, fsStep2 - task->begin);
                 }
+            }
 
-                case AceTreeEvent::ElementRemove: {
-                    auto event = static_cast<AceTreeElementEvent *>(e);
-                    removedItems.append(
-                        AceTreeItemPrivate::get(event->child())->clone_helper(false));
-                    break;
+            int cur = fsStep2 - task->begin;
+
+            // Index attributes in the same record format, uncompressed
+            if (attrsFile->isOpen()) {
+                QByteArray data;
+                {
+                    QDataStream out2(&data, QIODevice::WriteOnly);
+                    setAceTreeStreamVersion(out2);
+                    out2 << task->data.attributes;
                 }
 
-                case AceTreeEvent::RootChange: {
-                    auto event = static_cast<AceTreeRootEvent *>(e);
-                    if (event->oldRoot())
-                        removedItems.append(
-                            AceTreeItemPrivate::get(event->oldRoot())->clone_helper(false));
-                    break;
+                QDataStream out2(&attrRecords, QIODevice::WriteOnly | QIODevice::Append);
+                setAceTreeStreamVersion(out2);
+                out2 << qint32(cur) << qint32(data.size())
+                     << recordChecksum(cur, data.size(), data.constData());
+                attrRecords.append(data);
+            }
+
+            // Serialize transaction
+            QByteArray data;
+            {
+                QDataStream out2(&data, QIODevice::WriteOnly);
+                setAceTreeStreamVersion(out2);
+
+                auto &txData = task->data;
+
+                // Write attributes
+                out2 << txData.attributes;
+
+                // Write operation count
+                out2 << qint32(txData.operations.size());
+
+                // Write operations
+                for (const auto &op : qAsConst(txData.operations)) {
+                    // Inserted items are copied here instead of at commit
+                    Operations::takeSnapshots(op);
+
+                    out2 << op->c;
+                    op->write(out2);
                 }
+            }
 
-                default:
-                    break;
+            if (txAppend) {
+                data = compressData(txCodec, data);
+
+                QDataStream out2(&records, QIODevice::WriteOnly | QIODevice::Append);
+                setAceTreeStreamVersion(out2);
+                out2 << qint32(cur) << qint32(data.size())
+                     << recordChecksum(cur, data.size(), data.constData());
+                records.append(data);
+                continue;
             }
-        }
-    }
 
-    auto task = new Tasks::WriteCkptTask();
-    task->num = (min + stack.size()) / maxSteps;
-    task->removedItems = std::move(removedItems);
-    task->root = AceTreeItemPrivate::get(model->rootItem())->clone_helper(false);
-    return task;
-}
+            // Get current transaction start pos
+            qint64 pos;
+            if (cur == 1) {
+                pos = (maxSteps + 2) * sizeof(qint64); // Data section start
+            } else if (positions.contains(cur - 1)) {
+                pos = positions.value(cur - 1); // Previous transaction end in this batch
+            } else {
+                file.seek((cur - 1) * sizeof(qint64)); // Previous transaction end
+                out >> pos;
+            }
 
-void AceTreeJournalBackendPrivate::updateStackSize() {
-    // if (stack.size() > 3 * maxSteps) {
-    if (current <= maxSteps / 2) {
-        int size = stack.size() - 2 * maxSteps;
+            // Consecutive transactions are appended without seeking
+            if (pos != end) {
+                file.seek(pos);
+            }
+            file.write(data);
+            end = pos + data.size();
 
-        if (size > 0) {
-            // Abort forward transactions reading task
-            abortForwardReadTask();
+            positions.insert(cur, end);
+            last = cur;
+        }
 
-            // Remove tail
-            removeEvents(2 * maxSteps, stack.size());
+        // The index goes first, so that it never has an older version of a written transaction
+        if (!attrRecords.isEmpty()) {
+            attrsFile->write(attrRecords);
+            flushFile(*attrsFile);
+        }
 
-            myDebug().noquote().nospace()
-                << "[Journal] Remove forward transactions, size=" << size << ", min=" << min
-                << ", current=" << current << ", stack_size=" << stack.size();
+        if (committed && txAppend) {
+            // Allocate in chunks instead of extending the file by each batch
+            qint64 end2 = txEnd + records.size();
+            if (end2 > txAllocated) {
+                txAllocated = (end2 / kJournalChunkSize + 1) * kJournalChunkSize;
+                preallocateFile(file, txAllocated);
+            }
+
+            // A record of an earlier step supersedes the later ones, never seek
+            if (ring) {
+                ring->write(file.handle(), txEnd, records);
+                if (durability == AceTreeJournalBackend::DataSync) {
+                    ring->sync(file.handle());
+                }
+            } else {
+                file.write(records);
+                flushFile(file);
+            }
+            txEnd = end2;
+        } else if (committed) {
+            // Data must reach the file before the table
+            flushFile(file);
+
+            // Update count and pos table
+            for (auto it = positions.upperBound(last); it != positions.end();) {
+                it = positions.erase(it);
+            }
+            positions.insert(last + 1, -1); // end of pos table
+
+            file.seek(0);
+            out << qint64(last);
+            for (auto it = positions.begin(); it != positions.end();) {
+                // Write each contiguous run at once
+                QByteArray table;
+                QDataStream out2(&table, QIODevice::WriteOnly);
+                setAceTreeStreamVersion(out2);
+
+                int first = it.key();
+                int next = first;
+                for (; it != positions.end() && it.key() == next; ++it, ++next) {
+                    out2 << it.value();
+                }
+                file.seek(first * sizeof(qint64));
+                file.write(table);
+            }
+
+            // Flush
+            if (file.size() > end) {
+                file.resize(end);
+            }
+            flushFile(file);
         }
+    }
 
-    } else if (current > maxSteps * 2.5) {
-        // Abort backward transactions reading task
-        abortBackwardReadTask();
+    if (!committed && !stepped) {
+        return;
+    }
 
-        // Remove head
-        removeEvents(0, maxSteps);
-        min += maxSteps;
-        current -= maxSteps;
+    // Write steps (Must do it after writing transaction)
+    if (maxId > 0) {
+        maxId2 = maxId;
+    }
+    if (durability == AceTreeJournalBackend::PeriodicSync) {
+        stepsPending = true; // Written after the journal reaches the disk
+    } else {
+        writeSteps();
+    }
 
-        myDebug().noquote().nospace()
-            << "[Journal] Remove backward transactions, size=" << maxSteps << ", min=" << min
-            << ", current=" << current << ", stack_size=" << stack.size();
+    if (!committed) {
+        return;
     }
-    // }
-}
 
-bool AceTreeJournalBackendPrivate::acceptChangeMaxSteps(int steps) const {
-    return !recoverData && AceTreeMemBackendPrivate::acceptChangeMaxSteps(steps);
-}
+    // Truncate
+    {
+        // Remove backward logs
+        int oldMinNum = segmentOf(boundaries2, oldMin + 1);
+        int minNum = segmentOf(boundaries2, fsMin2 + 1);
+        for (int i = minNum - 1; i >= oldMinNum; --i) {
+            claimSwitchSegment(i, false);
+            truncateJournals(dir, i);
+        }
 
-void AceTreeJournalBackendPrivate::afterModelInfoSet() {
-    auto task = new Tasks::UpdateModelInfoTask();
-    task->info = modelInfo;
-    pushTask(task);
+        // Remove forward logs
+        for (int i = boundaries2.size(); i < oldCount; ++i) {
+            claimSwitchSegment(i, false);
+            truncateJournals(dir, i);
+        }
+    }
 }
 
-void AceTreeJournalBackendPrivate::afterCommit(const QList<AceTreeEvent *> &events,
-                                               const QHash<QString, QString> &attributes) {
-    // Update fsMax
-    fsMax = min + current;
-
-    // Update fsMin
-    int expectMin;
-    if (maxCheckPoints >= 0 &&
-        (expectMin = ((fsMax - 1) / maxSteps - (maxCheckPoints + 3)) * maxSteps) > fsMin) {
-        fsMin = expectMin;
+void AceTreeJournalBackendPrivate::writeSegmentEntry(int num, int begin) {
+    auto &file = *segmentsFile;
+    claimSwitchFile(QFileInfo(file).fileName());
+    if (!file.isOpen() && !file.open(QIODevice::ReadWrite)) {
+        return;
+    }
+    if (num == 0 || file.size() < 4) {
+        file.seek(0);
+        file.write(kSegmentsMagic, 4);
     }
 
-    // Abort forward transactions reading task
-    abortForwardReadTask();
+    // Entries after it belong to the overwritten segments
+    file.seek(4 + num * sizeof(qint32));
+    QDataStream out(&file);
+    setAceTreeStreamVersion(out);
+    out << qint32(begin);
 
-    // Abort backward transactions reading task
-    if (current > maxSteps * 1.5)
-        abortBackwardReadTask();
+    auto pos = file.pos();
+    if (file.size() > pos) {
+        file.resize(pos);
+    }
+    flushFile(file);
+}
 
-    // Delete formal checkpoint task
-    auto rem = stack.size() % maxSteps;
-    if (rem == 0) {
-        delete writeCkptTask;
+void AceTreeJournalBackendPrivate::openAttributesIndex(int num, int cur) {
+    auto &file = *attrsFile;
+    file.close();
+    file.setFileName(QString("%1/attrs_%2.dat").arg(dir, QString::number(num)));
+    claimSwitchFile(QFileInfo(file).fileName());
+    if (!file.open(QIODevice::ReadWrite)) {
+        return;
+    }
 
-        // Save checkpoint task
-        writeCkptTask = genWriteCkptTask();
-    } else if (rem == 1 && stack.size() > 1) {
-        // Deferred push checkpoint task
-        if (writeCkptTask) {
-            pushTask(writeCkptTask);
-            writeCkptTask = nullptr;
-        }
-    } else {
-        if (writeCkptTask) {
-            delete writeCkptTask;
-            writeCkptTask = nullptr;
+    if (isAppendJournal(file, nullptr, kAttributesMagic)) {
+        QVector<qint64> positions;
+        qint64 end;
+        {
+            MappedFile mapped(file);
+            end = scanJournal(*mapped.device(), positions, &mapped);
         }
-    }
 
-    // Add commit task (Must do it after writing checkpoint)
-    {
-        QVector<Operations::BaseOp *> ops;
-        ops.reserve(events.size());
-        bool needUpdateIdx = false;
-        for (const auto &event : events) {
-            ops.append(Operations::toOp(event));
-            switch (event->type()) {
-                case AceTreeEvent::RowsInsert:
-                case AceTreeEvent::RecordAdd:
-                case AceTreeEvent::ElementAdd:
-                case AceTreeEvent::RootChange:
-                    needUpdateIdx = true;
-                    break;
-                default:
-                    break;
+        // Drop torn records so that new records can follow
+        if (positions.size() >= cur - 1) {
+            if (file.size() > end) {
+                file.resize(end);
             }
+            file.seek(end);
+            return;
         }
-        auto task = new Tasks::CommitTask();
-        task->data = {std::move(ops), attributes};
-        task->fsStep = fsMax;
-        task->fsMin = fsMin;
-        if (needUpdateIdx) {
-            task->maxId = AceTreeModelPrivate::get(model)->maxIndex;
-        }
-        pushTask(task);
+    } else if (cur == 1) {
+        file.resize(0);
+        file.write(codecHeader(kAttributesMagic, AceTreeJournalBackend::NoCompression));
+        return;
     }
 
-    updateStackSize();
+    // Earlier steps are not indexed, read from the journal instead
+    file.close();
 }
 
-void AceTreeJournalBackendPrivate::afterReset() {
-    fsMin = 0;
-    fsMax = 0;
+void AceTreeJournalBackendPrivate::copierRoutine() {
+    Q_Q(AceTreeJournalBackend);
 
-    if (writeCkptTask) {
-        delete writeCkptTask;
-        writeCkptTask = nullptr;
-    }
+    auto &sc = switchCopy;
+    QStringList failed;
+    std::unique_lock<std::mutex> lock(sc.mtx);
+    while (!sc.quit && !sc.pending.isEmpty()) {
+        auto name = sc.pending.takeFirst();
+        sc.copying.append(name);
+        lock.unlock();
 
-    abortForwardReadTask();
-    abortBackwardReadTask();
+        if (!copyFile(QString("%1/%2").arg(sc.source, name),
+                      QString("%1/%2").arg(sc.target, name))) {
+            myWarning(__func__) << "copy" << name << "failed";
+            failed.append(name);
+        }
 
-    auto task = new Tasks::BaseTask(Tasks::Reset);
-    pushTask(task);
-}
+        lock.lock();
+        sc.copying.removeOne(name);
+        sc.cv.notify_all();
+    }
+
+    // Left to be claimed or copied by the next recovery, the source is kept
+    sc.pending.append(failed);
 
-void AceTreeJournalBackendPrivate::abortBackwardReadTask() {
-    if (!backward_buf) {
+    // Wait for the files being copied by others
+    sc.cv.wait(lock, [&sc]() {
+        return sc.copying.isEmpty(); //
+    });
+    if (!sc.pending.isEmpty()) {
         return;
     }
-    std::unique_lock<std::mutex> lock(backward_buf->mtx);
-    if (backward_buf->finished) {
-        delete backward_buf;
-        backward_buf = nullptr;
-    } else {
-        backward_buf->obsolete = true;
-        backward_buf = nullptr;
-    }
+    sc.active = false;
+
+    // Remove lock file 2, then lock file 1
+    QFile::remove(QString("%1/switch.lock").arg(sc.target));
+    QFile::remove(QString("%1/switch.lock").arg(sc.source));
+
+    myDebug().noquote().nospace() << "[Journal] Switch directory finished, " << sc.source << " -> "
+                                  << sc.target;
+
+    // Deferred remove directory
+    QTimer::singleShot(0, q, [oldDir = sc.source]() {
+        QDir(oldDir).removeRecursively(); //
+    });
 }
 
-void AceTreeJournalBackendPrivate::abortForwardReadTask() {
-    if (!forward_buf) {
+void AceTreeJournalBackendPrivate::claimSwitchFile(const QString &name, bool copy) {
+    auto &sc = switchCopy;
+    std::unique_lock<std::mutex> lock(sc.mtx);
+    if (!sc.active) {
         return;
     }
-    std::unique_lock<std::mutex> lock(forward_buf->mtx);
-    if (forward_buf->finished) {
-        delete forward_buf;
-        forward_buf = nullptr;
-    } else {
-        forward_buf->obsolete = true;
-        forward_buf = nullptr;
+
+    sc.cv.wait(lock, [&sc, &name]() {
+        return !sc.copying.contains(name); //
+    });
+    if (!sc.pending.removeOne(name) || !copy) {
+        return;
     }
-}
 
-void AceTreeJournalBackendPrivate::extractBackwardJournal(QVector<AceTreeItem *> &removedItems,
-                                                          QVector<Tasks::OpsAndAttrs> &data) {
-    int i = 0;
-    for (auto it = data.begin(); it != data.end(); ++it) {
-        myDebug() << min - data.size() + i + 1 << it->operations.first();
-        i++;
+    // Copy it now instead of waiting for the copier
+    sc.copying.append(name);
+    lock.unlock();
+
+    if (!copyFile(QString("%1/%2").arg(sc.source, name), QString("%1/%2").arg(sc.target, name))) {
+        myWarning(__func__) << "copy" << name << "failed";
     }
 
-    int size = data.size();
+    lock.lock();
+    sc.copying.removeOne(name);
+    sc.cv.notify_all();
+}
 
-    // Extrack transactions
-    QVector<TransactionData> stack1;
-    stack1.reserve(size);
+void AceTreeJournalBackendPrivate::claimSwitchSegment(int num, bool copy) {
+    for (const auto &pattern : {"journal_%1.dat", "ckpt_%1.dat", "attrs_%1.dat"}) {
+        claimSwitchFile(QString(pattern).arg(QString::number(num)), copy);
+    }
+}
 
-    auto model_p = AceTreeModelPrivate::get(model);
+void AceTreeJournalBackendPrivate::finishSwitchCopy() {
+    if (copier) {
+        copier->join();
+        delete copier;
+        copier = nullptr;
+    }
+}
 
-    // Add removed items to model
-    for (const auto &item : qAsConst(removedItems)) {
-        model_p->addManagedItem_backend(item);
+void AceTreeJournalBackendPrivate::flushFile(QFile &file) const {
+    switch (durability) {
+        case AceTreeJournalBackend::NoSync:
+            break;
+        case AceTreeJournalBackend::DataSync:
+            syncFile(file);
+            break;
+        default:
+            file.flush();
+            break;
     }
+}
 
-    // Get ownership
-    removedItems.clear();
+void AceTreeJournalBackendPrivate::writeSteps() {
+    auto &file = *stepFile;
+    if (!file.isOpen()) {
+        file.open(QIODevice::ReadWrite);
+    }
+    if (file.size() < kStepsHeaderSize) {
+        writeAt(file, 0, stepsHeader(maxSteps, maxCheckPoints));
+    }
 
-    for (const auto &item : qAsConst(data)) {
-        TransactionData tx;
-        tx.events.reserve(item.operations.size());
-        for (const auto &op : item.operations) {
-            auto e = Operations::fromOp(op, model, true);
-            tx.events.append(e);
+    // Alternate the slots, the other one keeps the previous steps if this write is torn
+    ++stepsSeq;
+    auto slot = stepsSlot(stepsSeq, fsMin2, fsMax2, fsStep2, maxId2);
+    if (ring) {
+        // Starts after the journal and checkpoint writes, and the earlier slot writes
+        ring->barrier();
+        ring->write(file.handle(), stepsSlotPos(stepsSeq), slot);
+        if (durability == AceTreeJournalBackend::DataSync) {
+            ring->sync(file.handle());
+        }
+    } else {
+        writeAt(file, stepsSlotPos(stepsSeq), slot);
+        if (durability == AceTreeJournalBackend::DataSync) {
+            syncFile(file);
         }
-        tx.attrs = item.attributes;
-        stack1.append(tx);
     }
 
-    stack = stack1 + stack;
-    min -= size;
-    current += size;
+    stepsPending = false;
 }
 
-void AceTreeJournalBackendPrivate::extractForwardJournal(QVector<Tasks::OpsAndAttrs> &data) {
-    int i = 0;
-    for (auto it = data.begin(); it != data.end(); ++it) {
-        myDebug() << min + current + i + 1 << it->operations.first();
-        i++;
-    }
-
-    auto size = data.size();
+void AceTreeJournalBackendPrivate::closeJournal() {
+    drainRing();
 
-    // Extrack transactions
-    QVector<TransactionData> stack1;
-    stack1.reserve(size);
+    auto &file = *txFile;
+    if (!file.isOpen()) {
+        return;
+    }
 
-    for (const auto &item : qAsConst(data)) {
-        TransactionData tx;
-        tx.events.reserve(item.operations.size());
-        for (const auto &op : item.operations) {
-            auto e = Operations::fromOp(op, model, false);
-            tx.events.append(e);
-        }
-        tx.attrs = item.attributes;
-        stack1.append(tx);
+    // Drop the preallocated space, truncating to the same size releases the space after the end
+    if (txAppend) {
+        file.resize(txEnd);
+    }
+    file.close();
+}
+
+void AceTreeJournalBackendPrivate::syncJournal() {
+    // Journal must reach the disk before the steps
+    drainRing();
+    if (txFile && txFile->isOpen()) {
+        syncFile(*txFile);
     }
 
-    stack += stack1;
+    if (stepsPending) {
+        writeSteps();
+        drainRing();
+        syncFile(*stepFile);
+    }
 }
 
-void AceTreeJournalBackendPrivate::afterCurrentChange() {
-    Q_Q(AceTreeJournalBackend);
+void AceTreeJournalBackendPrivate::drainRing() {
+    if (!ring) {
+        return;
+    }
 
-    // Push step updating task
-    {
-        auto task = new Tasks::ChangeStepTask();
-        task->fsStep = q->current();
-        pushTask(task);
+    ring->submit();
+    auto ready = reapRing(true);
+    ckptFile->close();
+
+    if (ready > 0) {
+        {
+            std::lock_guard<std::mutex> doneLock(doneMtx);
+            doneWrites += ready;
+        }
+        doneCv.notify_all();
+    }
+}
+
+qint64 AceTreeJournalBackendPrivate::reapRing(bool block) {
+    auto ticket = ring->reap(block);
+    if (ring->takeError()) {
+        myWarning(__func__) << "failed to write journal";
     }
 
-    // Check if backward transactions is enough to undo
-    if (current <= maxSteps / 2) {
+    // Writes are done in order
+    qint64 res = 0;
+    while (!pendingDone.isEmpty() && pendingDone.first().first <= ticket) {
+        res += pendingDone.takeFirst().second;
+    }
+    return res;
+}
 
-        if (fsMin < min) {
-            // Abort forward transactions reading task
-            abortForwardReadTask();
+/* Compaction (compact.lock)
+ *
+ * The commit that raises fsMin has removed the earlier segments, so the removed items in the
+ * checkpoint of the new oldest segment are no longer needed by undo. The checkpoint is rewritten
+ * beside the old one and then replaces it, the lock file tells the recovery to remove a partial
+ * one. The old checkpoint stays valid until then.
+ *
+ */
 
-            // Need to read backward transactions from file system
-            if (!backward_buf) {
-                int num = min / maxSteps - 1;
+void AceTreeJournalBackendPrivate::compactCheckPoint(int num) {
+    // The raised fsMin must be written before the removed items are dropped
+    if (stepsPending) {
+        syncJournal();
+    }
 
-                auto task = new Tasks::ReadCkptTask();
-                task->num = num;
+    // Folded again or reset meanwhile
+    if (num >= boundaries2.size() || fsMin2 != boundaries2.at(num)) {
+        return;
+    }
 
-                // Allocate buffer
-                backward_buf = new CheckPointTaskBuffer();
-                backward_buf->brief = true;
-                task->buf = backward_buf;
+    QString path = QString("%1/ckpt_%2.dat").arg(dir, QString::number(num));
+    claimSwitchFile(QFileInfo(path).fileName());
 
-                pushTask(task);
-            }
+    AceTreeItem *root = nullptr;
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly) || !readCheckPoint(file, &root, nullptr)) {
+            myWarning(__func__).noquote() << "read" << path << "failed";
+            return;
+        }
+    }
 
-            // Need to wait until the reading task finished
-            if (current == 0) {
-                std::unique_lock<std::mutex> lock(backward_buf->mtx);
-                while (!backward_buf->finished) {
-                    backward_buf->cv.wait(lock);
-                }
-            }
+    QString lockPath = QString("%1/compact.lock").arg(dir);
+    {
+        QSaveFile lockFile(lockPath);
+        if (!lockFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            delete root;
+            return;
+        }
+        QTextStream out(&lockFile);
+        out << num << Qt::endl;
+        out.flush();
+        if (!lockFile.commit()) {
+            delete root;
+            return;
+        }
+    }
 
-            // Insert backward transactions
-            if (backward_buf && backward_buf->finished) {
-                myDebug().noquote().nospace() << "[Journal] Prepend backward transactions, size="
-                                              << backward_buf->data.size();
+    QFile file(path + ".part");
+    bool success = file.open(QIODevice::WriteOnly | QIODevice::Truncate) &&
+                   writeCheckPoint(file, root, {}, compression);
+    delete root;
 
-                extractBackwardJournal(backward_buf->removedItems, backward_buf->data);
-                delete backward_buf;
-                backward_buf = nullptr;
-            }
+    if (success) {
+        if (durability == AceTreeJournalBackend::DataSync ||
+            durability == AceTreeJournalBackend::PeriodicSync) {
+            syncFile(file);
         }
+        file.close();
+        success = replaceFile(file.fileName(), path);
+    }
+    if (!success) {
+        file.remove();
+        myWarning(__func__).noquote() << "write" << path << "failed";
+    } else {
+        myDebug().noquote().nospace() << "[Journal] Compacted to checkpoint " << num;
+    }
+
+    QFile::remove(lockPath);
+}
 
+void AceTreeJournalBackendPrivate::scheduleSync() {
+    Q_Q(AceTreeJournalBackend);
+    if (durability != AceTreeJournalBackend::PeriodicSync || syncScheduled) {
+        return;
     }
+    syncScheduled = true;
 
-    // Check if forward transactions is enough to redo
-    else if (current > stack.size() - maxSteps / 2) {
+    QTimer::singleShot(syncInterval, q, [this]() {
+        syncScheduled = false;
+        pushTask(new Tasks::BaseTask(Tasks::Sync));
+    });
+}
 
-        if (fsMax > min + stack.size()) {
-            // Abort backward transactions reading task
-            abortBackwardReadTask();
+void AceTreeJournalBackendPrivate::executeReadTask(Tasks::BaseTask *cur_task) {
+    auto dir1 = readDir();
 
-            // Need to read backward transactions from file system
-            if (!forward_buf) {
-                int num = (min + stack.size()) / maxSteps;
+    switch (cur_task->t) {
+        case Tasks::ReadCheckPoint: {
+            auto task = static_cast<Tasks::ReadCkptTask *>(cur_task);
+            auto buf = reinterpret_cast<CheckPointTaskBuffer *>(task->buf);
 
-                auto task = new Tasks::ReadCkptTask();
-                task->num = num;
+            if (buf->obsolete) {
+                delete buf;
+                break;
+            }
 
-                // Allocate buffer
-                forward_buf = new CheckPointTaskBuffer();
-                task->buf = forward_buf;
+            // Files may be still copied from the last directory
+            claimSwitchSegment(task->num, true);
+            if (buf->brief) {
+                claimSwitchSegment(task->num + 1, true);
+            }
 
-                pushTask(task);
+            // Read checkpoint
+            if (buf->brief) {
+                QFile file(QString("%1/ckpt_%2.dat").arg(dir1, QString::number(task->num + 1)));
+                file.open(QIODevice::ReadOnly);
+                readCheckPoint(file, nullptr, &buf->removedItems);
             }
 
-            // Need to wait until the reading task finished
-            if (current == stack.size() - 1) {
-                std::unique_lock<std::mutex> lock(forward_buf->mtx);
-                while (!forward_buf->finished) {
-                    forward_buf->cv.wait(lock);
-                }
+            if (buf->obsolete) {
+                delete buf;
+                break;
             }
 
-            // Insert forward transactions
-            if (forward_buf && forward_buf->finished) {
-                myDebug().noquote().nospace()
-                    << "[Journal] Append forward transactions, size=" << forward_buf->data.size();
+            // Read transactions
+            {
+                QFile file(QString("%1/journal_%2.dat").arg(dir1, QString::number(task->num)));
+                file.open(QIODevice::ReadOnly);
+                readJournal(file, maxSteps, buf->data, buf->brief);
+            }
 
-                // Extrack transactions
-                extractForwardJournal(forward_buf->data);
-                delete forward_buf;
-                forward_buf = nullptr;
+            std::unique_lock<std::mutex> lock(buf->mtx);
+            if (buf->obsolete) {
+                lock.unlock();
+                delete buf;
+                break;
             }
+
+            buf->finished = true;
+            lock.unlock();
+            buf->cv.notify_all();
+
+            break;
         }
-    }
 
-    // Over
-    updateStackSize();
-}
+        case Tasks::ReadAttributes: {
+            auto task = static_cast<Tasks::ReadAttributesTask *>(cur_task);
+            auto buf = reinterpret_cast<AttributesTaskBuffer *>(task->buf);
 
-/* Steps data (model_stepss.dat)
- *
- * 0x0          maxSteps in a checkpoint
- * 0x4          maxCheckpoints
- * 0x8          min step in log
- * 0xC          max step in log
- * 0x10         current step
- * 0x14         max index in model
- *
- */
+            std::unique_lock<std::mutex> lock(buf->mtx);
+            buf->res = fs_getAttributes_do(task->num, task->cur);
+            buf->finished = true;
+            lock.unlock();
+            buf->cv.notify_all();
+            break;
+        }
 
-/* Checkpoint data (ckpt_XXX.dat)
- *
- * 0x0          CKPT
- * 0x4          removed items pos
- * 0xC          root id (0 if null)
- * 0x14         root data
- * 0xN          removed items size
- * 0xN+4        removed items data
- *
- */
+        case Tasks::ReadAttributesIndex: {
+            auto task = static_cast<Tasks::ReadAttrsIndexTask *>(cur_task);
+            auto buf = reinterpret_cast<AttributesIndexTaskBuffer *>(task->buf);
 
-/* Transaction data (journal_XXX.dat)
- *
- * 0x8              max entries
- * 0x10             entry 1
- * 0x18             entry 2
- * ...
- * 8*maxStep        entry maxStep
- * 8*maxStep+8      0xFFFFFFFFFFFFFFFF
- * 8*maxStep+16     transaction 0 (attributes + operations)
- * ...
- *
- */
+            std::unique_lock<std::mutex> lock(buf->mtx);
+            buf->res = fs_getAttributesIndex_do(task->num);
+            buf->finished = true;
+            lock.unlock();
+            buf->cv.notify_all();
+            break;
+        }
+
+        default:
+            break;
+    }
+}
 
 void AceTreeJournalBackendPrivate::workerRoutine() {
     Q_Q(AceTreeJournalBackend);
@@ -872,211 +2966,165 @@ void AceTreeJournalBackendPrivate::workerRoutine() {
             infoFile = new QFile(QString("%1/model_info.dat").arg(dir));
         }
 
+        if (!segmentsFile) {
+            segmentsFile = new QFile(QString("%1/segments.dat").arg(dir));
+        }
+
         if (!txFile) {
             txFile = new QFile();
         }
-    };
-
-    newFiles();
-
-    // Do initial work
-    while (!task_queue.empty()) {
-        std::unique_lock<std::mutex> lock(mtx);
-        auto cur_task = task_queue.front();
-        task_queue.pop_front();
-        lock.unlock();
-
-        // Execute task
-        switch (cur_task->t) {
-            case Tasks::Commit: {
-                auto task = static_cast<Tasks::CommitTask *>(cur_task);
-                int oldMin = fsMin2;
-                int oldMax = fsMax2;
-
-                fsMin2 = task->fsMin;
-                fsMax2 = task->fsStep;
-                fsStep2 = task->fsStep;
-
-                // Write transaction
-                {
-                    auto &file = *txFile;
-                    int num1 = (fsStep2 - 1) / maxSteps;
-                    if (!file.isOpen() || txNum != num1) {
-                        txNum = num1;
-
-                        // Reopen file
-                        file.close();
-                        file.setFileName(
-                            QString("%1/journal_%2.dat").arg(dir, QString::number(txNum)));
 
-                        auto exists = file.exists();
-                        file.open(QIODevice::ReadWrite);
-
-                        // Write initial zeros
-                        if (!exists) {
-                            QByteArray zero((maxSteps + 2) * sizeof(qint64), 0);
-                            file.write(zero);
-                            file.seek(0);
-                        }
-                    }
+        if (!attrsFile) {
+            attrsFile = new QFile();
+        }
 
-                    QDataStream out(&file);
-                    setAceTreeStreamVersion(out);
+        if (!ckptFile) {
+            ckptFile = new QFile();
+        }
+    };
 
-                    // Get current transaction start pos
-                    int cur = (fsStep2 - 1) % maxSteps + 1;
-                    if (cur == 1) {
-                        file.seek((maxSteps + 2) * sizeof(qint64)); // Data section start
-                    } else {
-                        file.seek((cur - 1) * sizeof(qint64));      // Previous transaction end
-                        qint64 pos;
-                        out >> pos;
-                        file.seek(pos);
-                    }
+    newFiles();
 
-                    auto &data = task->data;
+    // Falls back to blocking writes without io_uring
+    ring = ioUring ? IoRing::create() : nullptr;
 
-                    // Write attributes
-                    out << data.attributes;
+    while (true) {
+        auto cur_task = task_queue.pop();
+        if (!cur_task) {
+            if (!task_queue.empty()) {
+                std::this_thread::yield(); // Being pushed
+                continue;
+            }
 
-                    // Write operation count
-                    out << qint32(data.operations.size());
+            // Nothing to overlap with, finish the writes in flight
+            if (!pendingDone.isEmpty()) {
+                drainRing();
+                continue;
+            }
 
-                    // Write operations
-                    for (const auto &op : qAsConst(data.operations)) {
-                        out << op->c;
-                        op->write(out);
-                    }
+            if (workerQuit) {
+                break;
+            }
 
-                    file.flush();
+            // Park until a task is pushed, recheck after announcing
+            workerSleeping = true;
+            if (!task_queue.empty()) {
+                workerSleeping = false;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(parkMtx);
+            parkCv.wait(lock, [this]() {
+                return !workerSleeping || workerQuit; //
+            });
+            workerSleeping = false;
+            continue;
+        }
 
-                    // Update count and pos
-                    qint64 pos = file.pos();
-                    file.seek(0);
-                    out << qint64(cur);
-                    file.seek(cur * sizeof(qint64));
-                    out << pos;
-                    out << qint64(-1); // end of pos table
+        // Other tasks see the files written
+        if (cur_task->t != Tasks::Commit && cur_task->t != Tasks::ChangeStep &&
+            cur_task->t != Tasks::WriteCheckPoint) {
+            drainRing();
+        }
 
-                    // Flush
-                    if (file.size() > pos) {
-                        file.resize(pos);
-                    }
-                    file.flush();
+        // Execute task
+        qint64 done = 1;
+        switch (cur_task->t) {
+            case Tasks::Commit:
+            case Tasks::ChangeStep: {
+                // Take all pending commits and step changes of the same journal file
+                QVector<Tasks::BaseTask *> batch{cur_task};
+                int num = -1;
+                if (cur_task->t == Tasks::Commit) {
+                    num = static_cast<Tasks::CommitTask *>(cur_task)->num;
                 }
 
-                // Write steps (Must do it after writing transaction)
-                {
-                    auto &file = *stepFile;
-                    if (!file.isOpen()) {
-                        file.open(QIODevice::ReadWrite);
-                    }
-
-                    QByteArray data;
-                    QDataStream out(&data, QIODevice::WriteOnly);
-                    setAceTreeStreamVersion(out);
-                    out << fsMin2 << fsMax2 << fsStep2;
-                    if (task->maxId > 0) {
-                        out << task->maxId;
+                while (auto task = task_queue.peek()) {
+                    if (task->t == Tasks::Commit) {
+                        int num1 = static_cast<Tasks::CommitTask *>(task)->num;
+                        if (num >= 0 && num1 != num)
+                            break;
+                        num = num1;
+                    } else if (task->t != Tasks::ChangeStep) {
+                        break;
                     }
-
-                    // Call write once to ensure atomicity
-                    file.seek(8);
-                    file.write(data);
-                    file.flush();
+                    batch.append(task);
+                    task_queue.pop();
                 }
 
-                // Truncate
-                {
-                    // Remove backward logs
-                    int oldMinNum = oldMin / maxSteps;
-                    int minNum = fsMin2 / maxSteps;
-                    for (int i = minNum - 1; i >= oldMinNum; --i) {
-                        truncateJournals(dir, i);
-                    }
+                writeBatch(batch);
 
-                    // Remove forward logs
-                    int oldMaxNum = (oldMax - 1) / maxSteps;
-                    int maxNum = (fsMax2 - 1) / maxSteps;
-                    for (int i = maxNum + 1; i <= oldMaxNum; ++i) {
-                        truncateJournals(dir, i);
-                    }
+                for (int i = 1; i < batch.size(); ++i) {
+                    delete batch.at(i);
                 }
-
+                done = batch.size();
                 break;
             }
 
-            case Tasks::ChangeStep: {
-                auto task = static_cast<Tasks::ChangeStepTask *>(cur_task);
-                fsStep2 = task->fsStep;
-
-                // Write step
-                {
-                    auto &file = *stepFile;
-                    if (!file.isOpen())
-                        file.open(QIODevice::ReadWrite);
-
-                    file.seek(16);
-
-                    // Call write once
-                    QDataStream out(&file);
-                    setAceTreeStreamVersion(out);
-                    out << fsStep2;
-
-                    file.flush();
-                }
-
-                break;
-            }
+            case Tasks::WriteCheckPoint: {
+                auto task = static_cast<Tasks::WriteCkptTask *>(cur_task);
 
-            case Tasks::ReadCheckPoint: {
-                auto task = static_cast<Tasks::ReadCkptTask *>(cur_task);
-                auto buf = reinterpret_cast<CheckPointTaskBuffer *>(task->buf);
+                // Copy the items and keep them until the segment starts
+                if (task->copy) {
+                    if (task->rootSnapshot) {
+                        task->root = AceTreeModelPrivate::takeSnapshot(task->rootSnapshot);
+                        task->rootSnapshot = nullptr;
+                    }
+                    task->removedItems.reserve(task->removedSnapshots.size());
+                    for (const auto &snapshot : qAsConst(task->removedSnapshots)) {
+                        task->removedItems.append(AceTreeModelPrivate::takeSnapshot(snapshot));
+                    }
+                    task->removedSnapshots.clear();
 
-                if (buf->obsolete) {
-                    delete buf;
+                    delete heldCkpt;
+                    heldCkpt = task;
+                    cur_task = nullptr;
                     break;
                 }
 
-                // Read checkpoint
-                if (buf->brief) {
-                    QFile file(QString("%1/ckpt_%2.dat").arg(dir, QString::number(task->num + 1)));
-                    file.open(QIODevice::ReadOnly);
-                    readCheckPoint(file, nullptr, &buf->removedItems);
-                }
-
-                if (buf->obsolete) {
-                    delete buf;
+                // The copy is always pushed before
+                if (!heldCkpt || heldCkpt->num != task->num || heldCkpt->step != task->step) {
+                    myWarning(__func__) << "checkpoint" << task->num << "is not copied";
                     break;
                 }
+                delete cur_task;
+                cur_task = task = heldCkpt; // Deleted after writing
+                heldCkpt = nullptr;
 
-                // Read transactions
-                {
-                    QFile file(QString("%1/journal_%2.dat").arg(dir, QString::number(task->num)));
-                    file.open(QIODevice::ReadOnly);
-                    readJournal(file, maxSteps, buf->data, buf->brief);
+                // The file of the previous one is open until its writes are done
+                if (ring && ckptFile->isOpen()) {
+                    drainRing();
                 }
 
-                std::unique_lock<std::mutex> lock(buf->mtx);
-                if (buf->obsolete) {
-                    lock.unlock();
-                    delete buf;
+                auto &file = *ckptFile;
+                file.setFileName(QString("%1/ckpt_%2.dat").arg(dir, QString::number(task->num)));
+                claimSwitchFile(QFileInfo(file).fileName(), false); // Rewritten
+                file.open(QIODevice::ReadWrite);
+
+                // Journals after it depend on the checkpoint
+                bool sync = durability == AceTreeJournalBackend::DataSync ||
+                            durability == AceTreeJournalBackend::PeriodicSync;
+                if (ring) {
+                    // Serialized at once, written while the next commits go on
+                    QBuffer buf;
+                    buf.open(QIODevice::WriteOnly);
+                    writeCheckPoint(buf, task->root, task->removedItems, compression);
+                    ring->write(file.handle(), 0, buf.data());
+                    if (sync) {
+                        ring->sync(file.handle());
+                    }
                     break;
                 }
 
-                buf->finished = true;
-                lock.unlock();
-                buf->cv.notify_all();
-
+                writeCheckPoint(file, task->root, task->removedItems, compression);
+                if (sync) {
+                    syncFile(file);
+                }
+                file.close();
                 break;
             }
 
-            case Tasks::WriteCheckPoint: {
-                auto task = static_cast<Tasks::WriteCkptTask *>(cur_task);
-
-                QFile file(QString("%1/ckpt_%2.dat").arg(dir, QString::number(task->num)));
-                file.open(QIODevice::ReadWrite);
-                writeCheckPoint(file, task->root, task->removedItems);
+            case Tasks::Compact: {
+                compactCheckPoint(static_cast<Tasks::CompactTask *>(cur_task)->num);
                 break;
             }
 
@@ -1097,65 +3145,44 @@ void AceTreeJournalBackendPrivate::workerRoutine() {
                     if (file.size() > pos) {
                         file.resize(pos);
                     }
-                    file.flush();
+                    flushFile(file);
                 }
 
                 break;
             }
 
-            case Tasks::ReadAttributes: {
-                auto task = static_cast<Tasks::ReadAttributesTask *>(cur_task);
-                auto buf = reinterpret_cast<AttributesTaskBuffer *>(task->buf);
-
-                std::unique_lock<std::mutex> lock(buf->mtx);
-                buf->res = fs_getAttributes_do(task->step);
-                lock.unlock();
-                buf->cv.notify_all();
-            }
-
             case Tasks::Reset: {
                 // Remove all files
                 infoFile->remove();
 
-                int oldMin = fsMin2;
-                int oldMax = fsMax2;
+                int oldMinNum = segmentOf(boundaries2, fsMin2 + 1);
+                int oldMaxNum = boundaries2.size() - 1;
 
                 fsMin2 = 0;
                 fsMax2 = 0;
                 fsStep2 = 0;
+                maxId2 = 0;
+                stepsPending = false;
                 txNum = -1;
 
+                delete heldCkpt;
+                heldCkpt = nullptr;
+
                 // Write steps
-                {
-                    auto &file = *stepFile;
-                    bool exists = file.exists();
-                    if (!file.isOpen()) {
-                        file.open(QIODevice::ReadWrite);
-                    }
-                    QDataStream out(&file);
-                    setAceTreeStreamVersion(out);
-                    if (!exists) {
-                        // Write initial values
-                        out << maxSteps << maxCheckPoints;
-                    } else {
-                        file.seek(8);
-                    }
-                    out << fsMin2 << fsMax2 << fsStep2 << size_t(0);
-                    file.flush();
-                }
+                writeSteps();
 
                 // Truncate
                 {
-                    auto &file = *txFile;
-                    if (file.isOpen()) {
-                        file.close();
-                    }
-                    int oldMinNum = oldMin / maxSteps;
-                    int oldMaxNum = (oldMax - 1) / maxSteps;
+                    closeJournal();
+                    attrsFile->close();
                     for (int i = oldMaxNum; i >= oldMinNum; --i) {
+                        claimSwitchSegment(i, false);
                         truncateJournals(dir, i);
                     }
                 }
+
+                boundaries2 = {0};
+                writeSegmentEntry(0, 0);
                 break;
             }
 
@@ -1163,6 +3190,14 @@ void AceTreeJournalBackendPrivate::workerRoutine() {
                 auto task = static_cast<Tasks::SwitchDirTask *>(cur_task);
                 const auto &target = task->target;
 
+                // The last switch must be done
+                finishSwitchCopy();
+
+                // Files to copy must be complete
+                if (stepsPending) {
+                    syncJournal();
+                }
+
                 // Remove opened files
                 if (stepFile) {
                     stepFile->close();
@@ -1174,108 +3209,300 @@ void AceTreeJournalBackendPrivate::workerRoutine() {
                     infoFile->setFileName(QString("%1/model_info.dat").arg(target));
                 }
 
+                if (segmentsFile) {
+                    segmentsFile->close();
+                    segmentsFile->setFileName(QString("%1/segments.dat").arg(target));
+                }
+
                 if (txFile) {
-                    txFile->close();
+                    closeJournal();
+                }
+
+                if (attrsFile) {
+                    attrsFile->close();
                 }
 
                 // Start moving directory
 
                 // Collect files
-                int minNum = fsMin2 / maxSteps;
-                int maxNum = (fsMax2 - 1) / maxSteps;
+                int minNum = segmentOf(boundaries2, fsMin2 + 1);
+                int maxNum = boundaries2.size() - 1;
 
-                QFileInfoList filesToCopy{
-                    QFileInfo(QString("%1/model_steps.dat").arg(dir)),
-                };
+                QStringList filesToCopy{"model_steps.dat", "segments.dat"};
+                if (QFileInfo(QString("%1/model_info.dat").arg(dir)).isFile()) {
+                    filesToCopy.append("model_info.dat");
+                }
 
-                QFileInfo infoFile1(QString("%1/model_info.dat").arg(dir));
-                if (infoFile1.isFile()) {
-                    filesToCopy.append(infoFile1);
+                // The latest segments are more likely to be needed soon
+                for (int i = maxNum; i >= minNum; --i) {
+                    for (const auto &pattern : {"journal_%1.dat", "ckpt_%1.dat", "attrs_%1.dat"}) {
+                        auto name = QString(pattern).arg(QString::number(i));
+                        if (QFileInfo(QString("%1/%2").arg(dir, name)).isFile()) {
+                            filesToCopy.append(name);
+                        }
+                    }
                 }
 
-                for (int i = minNum; i <= maxNum; ++i) {
-                    filesToCopy.append({
-                        QFileInfo(QString("%1/journal_%2.dat").arg(dir, QString::number(i))),
-                        QFileInfo(QString("%1/ckpt_%2.dat").arg(dir, QString::number(i))),
-                    });
+                // Create lock file 2, then lock file 1
+                writeSwitchLock(target, dir, kSwitchTarget);
+                writeSwitchLock(dir, target, kSwitchSource);
+
+                // Write WARNING
+                q->createWarningFile(target);
+
+                // Link files on the same file system, otherwise the steps, the info and the
+                // segment index are copied at once and the segments in background
+                QStringList pending;
+                for (const auto &name : qAsConst(filesToCopy)) {
+                    auto from = QString("%1/%2").arg(dir, name);
+                    auto to = QString("%1/%2").arg(target, name);
+                    QFile::remove(to);
+                    if (linkFile(from, to)) {
+                        continue;
+                    }
+                    if (name.startsWith("model_") || name == "segments.dat") {
+                        if (!copyFile(from, to)) {
+                            myWarning(__func__) << "copy" << name << "failed";
+                        }
+                    } else {
+                        pending.append(name);
+                    }
                 }
 
-                QFile lockFile1(QString("%1/switch.lock").arg(dir));
-                QFile lockFile2(QString("%1/switch.lock").arg(target));
+                QString oldDir = dir;
+
+                if (pending.isEmpty()) {
+                    // Remove lock file 2, then lock file 1
+                    QFile::remove(QString("%1/switch.lock").arg(target));
+                    QFile::remove(QString("%1/switch.lock").arg(dir));
 
-                // Create lock file 2
-                {
-                    lockFile2.open(QIODevice::WriteOnly | QIODevice::Text);
-                    QTextStream out(&lockFile2);
-                    out << dir << Qt::endl;
-                    lockFile2.close();
+                    // Deferred remove directory
+                    QTimer::singleShot(0, q, [oldDir]() {
+                        QDir(oldDir).removeRecursively(); //
+                    });
+                } else {
+                    // From now on the target is the one to recover
+                    writeSwitchLock(target, dir, kSwitchTargetIncremental);
+
+                    std::unique_lock<std::mutex> copyLock(switchCopy.mtx);
+                    switchCopy.source = oldDir;
+                    switchCopy.target = target;
+                    switchCopy.pending = pending;
+                    switchCopy.active = true;
+                    copyLock.unlock();
+
+                    copier = new std::thread(&AceTreeJournalBackendPrivate::copierRoutine, this);
                 }
 
-                // Create lock file 1
+                // Swtich directory name
                 {
-                    lockFile1.open(QIODevice::WriteOnly | QIODevice::Text);
-                    QTextStream out(&lockFile1);
-                    out << task->target << Qt::endl;
+                    std::lock_guard<std::mutex> dirLock(dirMtx);
+                    dir = target;
                 }
 
-                // Write WARNING
-                q->createWarningFile(target);
+                newFiles();
 
-                // Copy files
-                for (const auto &info : qAsConst(filesToCopy)) {
-                    QFile::copy(info.absoluteFilePath(),
-                                QString("%1/%2").arg(target, info.fileName()));
-                }
+                break;
+            }
 
-                // Remove lock file 2
-                lockFile2.remove();
+            case Tasks::Sync: {
+                syncJournal();
+                break;
+            }
 
-                // Remove lock file 1
-                lockFile1.remove();
+            case Tasks::Recover: {
+                auto task = static_cast<Tasks::RecoverTask *>(cur_task);
+                auto buf = reinterpret_cast<RecoverTaskBuffer *>(task->buf);
 
-                // Remove old directory
-                QString oldDir = dir;
+                // Skipped if the result is already taken by setup
+                auto post = [this, q, buf](const std::function<void()> &func) {
+                    QTimer::singleShot(0, q, [this, buf, func]() {
+                        if (recoverBuf == buf)
+                            func();
+                    });
+                };
 
-                // Swtich directory name
-                dir = target;
+                RecoverData *rdata = nullptr;
+                bool success = recover_helper(
+                    buf->dir, rdata,
+                    [q, &post](qint64 bytesRead, qint64 bytesTotal) {
+                        post([q, bytesRead, bytesTotal]() {
+                            emit q->recoverProgress(bytesRead, bytesTotal); //
+                        });
+                    },
+                    [q, &post](AceTreeItem *root) {
+                        post([q, root]() {
+                            emit q->recoverRootLoaded(root); //
+                        });
+                    });
+
+                std::unique_lock<std::mutex> lock(buf->mtx);
+                buf->data = rdata; // Kept until finished if failed, the root may be emitted
+                buf->success = success;
+                buf->finished = true;
+                lock.unlock();
+                buf->cv.notify_all();
 
-                // Deferred remove directory
-                QTimer::singleShot(0, q, [oldDir]() {
-                    QDir(oldDir).removeRecursively(); //
+                post([this]() {
+                    finishRecoverTask(); //
                 });
+                break;
+            }
 
-                newFiles();
+            default:
+                break;
+        }
+
+        delete cur_task;
+
+        // The task is done when the ring finishes the writes submitted so far
+        qint64 ready = done;
+        if (ring) {
+            auto ticket = ring->submit();
+            if (!pendingDone.isEmpty() && pendingDone.last().first == ticket) {
+                pendingDone.last().second += done;
+            } else {
+                pendingDone.append({ticket, done});
+            }
+            ready = reapRing(false);
+        }
+
+        // Wake up reads depending on the writes
+        {
+            std::lock_guard<std::mutex> doneLock(doneMtx);
+            doneWrites += ready;
+        }
+        doneCv.notify_all();
+    }
+
+    delete ring;
+    ring = nullptr;
+
+    delete heldCkpt;
+    heldCkpt = nullptr;
+}
 
-                break;
-            }
+void AceTreeJournalBackendPrivate::readerRoutine() {
+    while (true) {
+        // Park until a read is pushed, the pending reads are done before quitting
+        std::unique_lock<std::mutex> lock(readMtx);
+        readCv.wait(lock, [this]() {
+            return !read_queue.empty() || readerQuit; //
+        });
+        if (read_queue.empty()) {
+            break;
+        }
+        auto cur_task = read_queue.front();
+        read_queue.pop_front();
+        lock.unlock();
 
-            default:
-                break;
+        // Wait for the segments to be written
+        {
+            std::unique_lock<std::mutex> doneLock(doneMtx);
+            doneCv.wait(doneLock, [this, cur_task]() {
+                return doneWrites >= cur_task->after; //
+            });
         }
 
+        executeReadTask(cur_task);
         delete cur_task;
     }
-
-    // This deferred task will be skipped if instance is deleted
-    QTimer::singleShot(0, q, [this]() {
-        worker->join();
-        delete worker;
-        worker = nullptr;
-    });
 }
 
-void AceTreeJournalBackendPrivate::pushTask(Tasks::BaseTask *task, bool unshift) {
-    std::unique_lock<std::mutex> lock(mtx);
+void AceTreeJournalBackendPrivate::pushReadTask(Tasks::BaseTask *task, bool unshift) {
+    // Segments to read, a checkpoint read also takes the one of the next segment
+    int num = -1;
+    bool next = false;
+    switch (task->t) {
+        case Tasks::ReadCheckPoint:
+            num = static_cast<Tasks::ReadCkptTask *>(task)->num;
+            next = true;
+            break;
+        case Tasks::ReadAttributes:
+            num = static_cast<Tasks::ReadAttributesTask *>(task)->num;
+            break;
+        case Tasks::ReadAttributesIndex:
+            num = static_cast<Tasks::ReadAttrsIndexTask *>(task)->num;
+            break;
+        default:
+            break;
+    }
+    task->after = qMax(barrierWrites, segmentWrites.value(num));
+    if (next) {
+        task->after = qMax(task->after, segmentWrites.value(num + 1));
+    }
+
+    std::unique_lock<std::mutex> lock(readMtx);
     if (unshift)
-        task_queue.push_front(task);
+        read_queue.push_front(task);
     else
-        task_queue.push_back(task);
+        read_queue.push_back(task);
     lock.unlock();
+
+    if (!reader) {
+        reader = new std::thread(&AceTreeJournalBackendPrivate::readerRoutine, this);
+    } else {
+        readCv.notify_one();
+    }
+
+    myDebug() << "[Journal] Push read task" << task->t;
+}
+
+QString AceTreeJournalBackendPrivate::readDir() const {
+    std::lock_guard<std::mutex> lock(dirMtx);
+    return dir;
+}
+
+void AceTreeJournalBackendPrivate::pushTask(Tasks::BaseTask *task, bool unshift) {
+    switch (task->t) {
+        case Tasks::ReadCheckPoint:
+        case Tasks::ReadAttributes:
+        case Tasks::ReadAttributesIndex:
+            pushReadTask(task, unshift);
+            return;
+        default:
+            break;
+    }
+
+    // Track the writes that reads depend on
+    ++pushedWrites;
+    switch (task->t) {
+        case Tasks::Commit:
+            segmentWrites.insert(static_cast<Tasks::CommitTask *>(task)->num, pushedWrites);
+            break;
+        case Tasks::WriteCheckPoint:
+            segmentWrites.insert(static_cast<Tasks::WriteCkptTask *>(task)->num, pushedWrites);
+            break;
+        case Tasks::Compact:
+            segmentWrites.insert(static_cast<Tasks::CompactTask *>(task)->num, pushedWrites);
+            break;
+        case Tasks::Reset:
+        case Tasks::SwitchDirectory:
+        case Tasks::Recover:
+            barrierWrites = pushedWrites;
+            segmentWrites.clear();
+            break;
+        default:
+            break;
+    }
+
+    // The task may be deleted by worker once pushed
+    bool needSync = task->t == Tasks::Commit || task->t == Tasks::ChangeStep;
+
+    myDebug() << "[Journal] Push task" << task->t;
+
+    // Writes are always in order
+    task_queue.push(task);
     if (!worker) {
         worker = new std::thread(&AceTreeJournalBackendPrivate::workerRoutine, this);
+    } else if (workerSleeping.exchange(false)) {
+        std::lock_guard<std::mutex> lock(parkMtx);
+        parkCv.notify_one();
     }
 
-    myDebug() << "[Journal] Push task" << task->t;
+    if (needSync) {
+        scheduleSync();
+    }
 }
 
 AceTreeJournalBackend::AceTreeJournalBackend(QObject *parent)
@@ -1302,6 +3529,45 @@ void AceTreeJournalBackend::setReservedCheckPoints(int n) {
     d->maxCheckPoints = n;
 }
 
+int AceTreeJournalBackend::compactThreshold() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->compactThreshold;
+}
+
+void AceTreeJournalBackend::setCompactThreshold(int n) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->compactThreshold = qMax(n, 0);
+}
+
+int AceTreeJournalBackend::segmentSteps() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->segmentSteps;
+}
+
+void AceTreeJournalBackend::setSegmentSteps(int n) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->segmentSteps = qMax(n, 0);
+}
+
+qint64 AceTreeJournalBackend::segmentBytes() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->segmentBytes;
+}
+
+void AceTreeJournalBackend::setSegmentBytes(qint64 bytes) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->segmentBytes = qMax(bytes, qint64(0));
+}
+
 static bool checkDir_helper(const char *func, const QString &dir) {
     QFileInfo info(dir);
     if (dir.isEmpty() || !info.isDir() || !info.isWritable()) {
@@ -1311,6 +3577,71 @@ static bool checkDir_helper(const char *func, const QString &dir) {
     return true;
 }
 
+AceTreeJournalBackend::Durability AceTreeJournalBackend::durability() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->durability;
+}
+
+AceTreeJournalBackend::Compression AceTreeJournalBackend::compression() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->compression;
+}
+
+void AceTreeJournalBackend::setCompression(Compression compression) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->compression = compression;
+}
+
+bool AceTreeJournalBackend::lazyLoading() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->lazyLoading;
+}
+
+void AceTreeJournalBackend::setLazyLoading(bool on) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->lazyLoading = on;
+}
+
+bool AceTreeJournalBackend::ioUring() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->ioUring;
+}
+
+void AceTreeJournalBackend::setIoUring(bool on) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model || d->worker) {
+        return; // Not allowed to change after the worker starts
+    }
+    d->ioUring = on;
+}
+
+void AceTreeJournalBackend::setDurability(Durability durability) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->durability = durability;
+}
+
+int AceTreeJournalBackend::syncInterval() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->syncInterval;
+}
+
+void AceTreeJournalBackend::setSyncInterval(int ms) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+    d->syncInterval = qMax(ms, 1);
+}
+
 bool AceTreeJournalBackend::start(const QString &dir) {
     Q_D(AceTreeJournalBackend);
     if (!checkDir_helper(__func__, dir)) {
@@ -1322,81 +3653,160 @@ bool AceTreeJournalBackend::start(const QString &dir) {
         d->recoverData = nullptr;
     }
     d->dir = dir;
+    d->lostSteps = {0, 0};
 
     return true;
 }
 
-bool AceTreeJournalBackend::recover(const QString &dir) {
-    Q_D(AceTreeJournalBackend);
-
-    if (!checkDir_helper(__func__, dir)) {
-        return false;
-    }
-
+bool AceTreeJournalBackendPrivate::recover_helper(
+    const QString &dir, RecoverData *&res, const RecoverCallback &progress,
+    const std::function<void(AceTreeItem *)> &rootLoaded) const {
     // 3. Crash diring directory switching
     {
-        QString targetDir;
-        QString refDir;
+        QString otherDir, role;
+        QString refDir, otherRole;
 
-        QFile lockFile1(QString("%1/switch.lock").arg(dir));
-        if (!lockFile1.open(QIODevice::ReadOnly)) {
+        QString lockPath1 = QString("%1/switch.lock").arg(dir);
+        if (!readSwitchLock(dir, otherDir, role)) {
             goto out_fix;
         }
 
-        QTextStream in(&lockFile1);
-        targetDir = in.readLine();
-        lockFile1.close();
-
-        QFile lockFile2(QString("%1/switch.lock").arg(targetDir));
-        if (!lockFile2.open(QIODevice::ReadOnly)) {
-            lockFile1.remove();
+        QString lockPath2 = QString("%1/switch.lock").arg(otherDir);
+        if (!readSwitchLock(otherDir, refDir, otherRole) ||
+            QDir(dir).canonicalPath() != QFileInfo(refDir).canonicalFilePath()) {
+            // The other side has finished or never started
+            QFile::remove(lockPath1);
             goto out_fix;
         }
 
-        in.setDevice(&lockFile2);
-        refDir = in.readLine();
-        lockFile2.close();
+        if (role == kSwitchTargetIncremental) {
+            // Crash occurs when copying files in background, the journal continues here
+            completeSwitchCopy(otherDir, dir);
+            QFile::remove(lockPath1);
+            QFile::remove(lockPath2);
+            QDir(otherDir).removeRecursively();
+        } else if (otherRole == kSwitchTargetIncremental) {
+            // The journal has moved to the other directory
+            completeSwitchCopy(dir, otherDir);
+            QFile::remove(lockPath2);
+            QFile::remove(lockPath1);
+            QDir(dir).removeRecursively();
+            myWarning(__func__) << "journal has been moved to" << otherDir;
+            return false;
+        } else if (role == kSwitchTarget) {
+            // Crash occurs when linking files, recover from the source directory
+            myWarning(__func__) << "directory switching from" << otherDir << "is not finished";
+            return false;
+        } else {
+            // Crash occurs when linking files
+            QDir(otherDir).removeRecursively();
+            QFile::remove(lockPath1);
+        }
+    }
 
-        QDir newDir(targetDir);
-        if (newDir.canonicalPath() == QFileInfo(refDir).canonicalFilePath()) {
-            // Crash occurs when copying files
-            newDir.removeRecursively();
+out_fix:
+    // 4. Crash during compaction, the old checkpoint is still in place
+    {
+        QFile lockFile(QString("%1/compact.lock").arg(dir));
+        if (lockFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QTextStream in(&lockFile);
+            auto num = in.readLine();
+            lockFile.close();
+
+            QFile::remove(QString("%1/ckpt_%2.dat.part").arg(dir, num));
+            lockFile.remove();
         }
+    }
 
-        lockFile1.remove();
+    // Read steps, a torn update leaves the previous slot
+    StepsData steps;
+    if (!readStepsFile(dir, steps)) {
+        myWarning(__func__) << "read model_steps.dat failed";
+        return false;
     }
+    int maxSteps = steps.maxSteps;
+    int maxCheckPoints = steps.maxCheckPoints;
+    int fsMin = steps.fsMin;
+    int fsMax = steps.fsMax;
+    int fsStep = steps.fsStep;
+    size_t maxId = steps.maxId;
+
+    // Directories without an index have segments of maxSteps
+    QVector<int> b;
+    bool indexed = readSegmentIndex(dir, maxSteps, fsMax, b);
+    const auto oldBoundaries = b;
+
+    // Roll back to the last valid transaction:
+    // 1. Damaged transactions, or lost ones that did not reach the disk
+    QPair<int, int> lost = {0, 0};
+    if (fsMax > 0) {
+        int minNum = segmentOf(b, fsMin + 1);
+        int maxNum = b.size() - 1;
+        for (int num = minNum; num <= maxNum; ++num) {
+            QFile file(QString("%1/journal_%2.dat").arg(dir, QString::number(num)));
+            if (!file.open(QIODevice::ReadOnly)) {
+                continue; // Checked later
+            }
 
-out_fix:
-    // Read steps
-    int maxSteps, maxCheckPoints, fsMin, fsMax, fsStep;
-    size_t maxId;
-    auto readSteps = [&](QFile &file) {
-        QDataStream in(&file);
-        setAceTreeStreamVersion(in);
-        in >> maxSteps >> maxCheckPoints >> fsMin >> fsMax >> fsStep >> maxId;
-        if (in.status() != QDataStream::Ok) {
-            return false;
+            MappedFile mapped(file);
+            auto &dev = *mapped.device();
+            if (!isAppendJournal(dev)) {
+                continue; // No checksums
+            }
+
+            QVector<qint64> positions;
+            qint64 end = scanJournal(dev, positions, &mapped);
+            int valid = b.at(num) + positions.size();
+            if (valid >= (num < maxNum ? qMin(fsMax, b.at(num + 1)) : fsMax)) {
+                continue;
+            }
+
+            if (valid <= fsMin && fsMin > 0) {
+                myWarning(__func__).noquote()
+                    << QString("journal_%1.dat is damaged, no valid transaction left")
+                           .arg(QString::number(num));
+                return false;
+            }
+
+            myWarning(__func__).noquote()
+                << QString("journal_%1.dat is damaged at %2, steps %3 to %4 are lost, "
+                           "current step %5 -> %6")
+                       .arg(QString::number(num), QString::number(end), QString::number(valid + 1),
+                            QString::number(fsMax), QString::number(fsStep),
+                            QString::number(qMin(fsStep, valid)));
+
+            lost = {valid + 1, fsMax};
+            fsMax = valid;
+            fsStep = qMin(fsStep, valid);
+            break;
         }
-        return true;
-    };
-    {
-        QFile file(QString("%1/model_steps.dat").arg(dir));
-        if (!file.open(QIODevice::ReadOnly) || !readSteps(file)) {
-            myWarning(__func__) << "read model_steps.dat failed";
+    }
+
+    // Update steps, an older file is converted to slots
+    if (lost.first > 0 || steps.legacy) {
+        steps.fsMax = fsMax;
+        steps.fsStep = fsStep;
+        ++steps.seq;
+        if (!writeStepsFile(dir, steps)) {
+            myWarning(__func__) << "write model_steps.dat failed";
             return false;
         }
     }
 
-    // Unhandled inconsistency (Merely impossible)
-    // 1. Crash during updating steps
+    // Segments started by a transaction that did not reach the steps
+    while (b.size() > 1 && b.last() >= fsMax) {
+        truncateJournals(dir, b.size() - 1);
+        b.removeLast();
+    }
 
     // Fix possible inconsistency:
     // 1. Crash during writing commited transaction or writing checkpoint,
     //    before updating steps
-    {
-        qint64 expected = fsMax % maxSteps;
-        if (expected > 0) {
-            int num = (fsMax - 1) / maxSteps;
+    // 2. Damaged transactions to drop after rolling back
+    if (fsMax > 0) {
+        int num = b.size() - 1;
+        qint64 expected = fsMax - b.last();
+        {
             QFile file(QString("%1/journal_%2.dat").arg(dir, QString::number(num)));
             if (!file.open(QIODevice::ReadWrite)) {
                 myWarning(__func__).noquote()
@@ -1406,6 +3816,37 @@ out_fix:
 
             QDataStream in(&file);
             setAceTreeStreamVersion(in);
+
+            if (isAppendJournal(file)) {
+                QVector<qint64> positions;
+                qint64 end;
+                {
+                    MappedFile mapped(file);
+                    end = scanJournal(*mapped.device(), positions, &mapped);
+                }
+
+                // Drop torn or damaged records so that new records can follow
+                if (file.size() > end) {
+                    file.resize(end);
+                }
+
+                if (positions.size() > expected) {
+                    myDebug().noquote().nospace()
+                        << "[Journal] Journal step inconsistent, expected " << expected
+                        << ", actual " << positions.size();
+
+                    // Append a truncation mark
+                    file.seek(end);
+                    in << qint32(expected + 1) << qint32(-1)
+                       << recordChecksum(qint32(expected + 1), -1, nullptr);
+                } else if (positions.size() < expected) {
+                    myWarning(__func__).noquote()
+                        << QString("journal_%1.dat is incomplete").arg(QString::number(num));
+                    return false;
+                }
+                goto out_truncate;
+            }
+
             qint64 cur;
             in >> cur;
 
@@ -1423,23 +3864,24 @@ out_fix:
                 in << qint64(-1);
                 file.resize(pos);
             }
-        } else {
-            // The first transaction may failed to be flushed
-            truncateJournals(dir, fsMax / maxSteps);
         }
+    } else {
+        // The first transaction may failed to be flushed
+        truncateJournals(dir, 0);
     }
 
+out_truncate:
     // 2. Crash during truncating logs
     {
         // Remove backward logs
-        int minNum = fsMin / maxSteps;
+        int minNum = segmentOf(b, fsMin + 1);
         for (int i = minNum - 1; i >= 0; --i) {
             if (!truncateJournals(dir, i))
                 break;
         }
 
         // Remove forward logs
-        int maxNum = (fsMax - 1) / maxSteps;
+        int maxNum = b.size() - 1;
         for (int i = maxNum + 1;; ++i) {
             if (!truncateJournals(dir, i))
                 break;
@@ -1456,6 +3898,12 @@ out_fix:
         }
     }
 
+    // Index an older directory, or drop the entries of the removed segments
+    if ((!indexed || b != oldBoundaries) && !writeSegmentIndex(dir, b)) {
+        myWarning(__func__) << "write segments.dat failed";
+        return false;
+    }
+
     QVariantHash modelInfo;
     {
         QFile file(QString("%1/model_info.dat").arg(dir));
@@ -1469,55 +3917,91 @@ out_fix:
         }
     }
 
+    auto rdata = new RecoverData();
+    rdata->fsMax = fsMax;
+    rdata->lostSteps = lost;
+    rdata->boundaries = b;
+    rdata->legacySegments = indexed ? 0 : b.size();
     if (fsMax == 0) {
-        d->dir = dir;
+        res = rdata;
         return true;
     }
 
     // Get nearest checkpoint
-    // Suppose maxSteps = 100
+    // Suppose the segments begin after 0, 100, 200
     // 1. 51 <= fsStep <= 150                         -> num = 1
     // 2. 151 <= fsStep <= 250                        -> num = 2
-    // 3. fsStep >= 151, fsMin = 100, fsMax <= 200    -> num = 1
+    // 3. fsStep >= 151, fsMax <= 200                 -> num = 1
 
-    int minNum = fsMin / maxSteps;
-    int maxNum = qMax((fsMax - 1) / maxSteps, 0);
-    int num = qMin((fsStep + maxSteps / 2 - 1) / maxSteps, maxNum);
+    int minNum = segmentOf(b, fsMin + 1);
+    int maxNum = b.size() - 1;
+    int num = segmentOf(b, fsStep);
+    {
+        int len = (num < maxNum ? b.at(num + 1) : fsMax) - b.at(num);
+        if (fsStep - b.at(num) > len / 2 && num < maxNum) {
+            ++num;
+        }
+    }
 
     myDebug().noquote().nospace() << "[Journal] Restore, (min, max, cur)=(" << fsMin << ", "
                                   << fsMax << ", " << fsStep << ")";
     myDebug().noquote().nospace() << "[Journal] Read checkpoint " << num;
 
-    AceTreeItem *root = nullptr;
-    QVector<AceTreeItem *> removedItems;
-    QVector<Tasks::OpsAndAttrs> backwardData;
-    QVector<Tasks::OpsAndAttrs> forwardData;
+    bool needBackward = num > 0 && num > minNum;
 
+    // Progress in bytes of the files to read
+    QString ckptPath = QString("%1/ckpt_%2.dat").arg(dir, QString::number(num));
+    QString backwardPath = QString("%1/journal_%2.dat").arg(dir, QString::number(num - 1));
+    QString forwardPath = QString("%1/journal_%2.dat").arg(dir, QString::number(num));
+    qint64 bytesRead = 0;
+    qint64 bytesTotal = QFileInfo(forwardPath).size();
     if (num > 0) {
-        bool needBackward = num > minNum;
+        bytesTotal += QFileInfo(ckptPath).size();
+        if (needBackward) {
+            bytesTotal += QFileInfo(backwardPath).size();
+        }
+    }
+    auto reportProgress = [&](QFile &file) {
+        if (progress) {
+            bytesRead += file.size();
+            progress(bytesRead, bytesTotal);
+        }
+    };
+    if (progress) {
+        progress(0, bytesTotal);
+    }
 
+    if (num > 0) {
         // Read checkpoint
         {
-            QFile file(QString("%1/ckpt_%2.dat").arg(dir, QString::number(num)));
+            QFile file(ckptPath);
             if (!file.open(QIODevice::ReadOnly) ||
-                !d->readCheckPoint(file, &root, needBackward ? &removedItems : nullptr)) {
+                !readCheckPoint(file, &rdata->root, needBackward ? &rdata->removedItems : nullptr,
+                                lazyLoading)) {
                 myWarning(__func__).noquote()
                     << QString("read ckpt_%1.dat failed").arg(QString::number(num));
-                return false;
+                goto failed;
             }
+            reportProgress(file);
+        }
+
+        // Valid until the caller deletes the data, also on failure
+        if (rootLoaded && rdata->root) {
+            rootLoaded(rdata->root);
         }
 
         // Read backward transactions
         if (needBackward) {
             myDebug().noquote().nospace() << "[Journal] Restore backward transactions " << num - 1;
 
-            QFile file(QString("%1/journal_%2.dat").arg(dir, QString::number(num - 1)));
+            QFile file(backwardPath);
             if (!file.open(QIODevice::ReadOnly) ||
-                !d->readJournal(file, maxSteps, backwardData, true)) {
+                !readJournal(file, maxSteps, rdata->backwardData, true)) {
                 myWarning(__func__).noquote()
                     << QString("read journal_%1.dat failed").arg(QString::number(num - 1));
                 goto failed;
             }
+            reportProgress(file);
         }
     }
 
@@ -1525,41 +4009,128 @@ out_fix:
         myDebug().noquote().nospace() << "[Journal] Restore forward transactions " << num;
 
         // Read forward transactions
-        QFile file(QString("%1/journal_%2.dat").arg(dir, QString::number(num)));
+        QFile file(forwardPath);
         if (!file.open(QIODevice::ReadOnly) ||
-            !d->readJournal(file, maxSteps, forwardData, false)) {
+            !readJournal(file, maxSteps, rdata->forwardData, false)) {
             myWarning(__func__).noquote()
                 << QString("read journal_%1.dat failed").arg(QString::number(num));
             goto failed;
         }
+        reportProgress(file);
     }
 
-    goto success;
-
-failed:
-    delete root;
-    qDeleteAll(removedItems);
-    return false;
-
-success:
-    auto rdata = new AceTreeJournalBackendPrivate::RecoverData();
     rdata->fsMin = fsMin;
-    rdata->fsMax = fsMax;
     rdata->fsStep = fsStep;
     rdata->currentNum = num;
     rdata->maxId = maxId;
-    rdata->root = root;
-    rdata->removedItems = removedItems;
-    rdata->backwardData = backwardData;
-    rdata->forwardData = forwardData;
-    d->maxSteps = maxSteps;
-    d->maxCheckPoints = maxCheckPoints;
-    d->recoverData = rdata;
+    rdata->stepsSeq = steps.seq;
+    rdata->maxSteps = maxSteps;
+    rdata->maxCheckPoints = maxCheckPoints;
+    rdata->modelInfo = modelInfo;
+
+    res = rdata;
+    return true;
+
+failed:
+    res = rdata;
+    return false;
+}
+
+void AceTreeJournalBackendPrivate::applyRecoverData(const QString &dir, RecoverData *rdata) {
+    delete recoverData;
+    recoverData = nullptr;
+
+    this->dir = dir;
+    lostSteps = rdata->lostSteps;
+    attrsCache.clear();
+    if (rdata->fsMax == 0) {
+        delete rdata;
+        return;
+    }
+
+    maxSteps = rdata->maxSteps;
+    maxCheckPoints = rdata->maxCheckPoints;
+    modelInfo = rdata->modelInfo;
+    recoverData = rdata;
+}
+
+void AceTreeJournalBackendPrivate::finishRecoverTask() {
+    Q_Q(AceTreeJournalBackend);
+
+    auto buf = recoverBuf;
+    recoverBuf = nullptr;
+
+    std::unique_lock<std::mutex> lock(buf->mtx);
+    buf->cv.wait(lock, [buf]() {
+        return buf->finished; //
+    });
+    lock.unlock();
+
+    bool success = buf->success;
+    if (success) {
+        applyRecoverData(buf->dir, buf->data);
+        buf->data = nullptr;
+    } else {
+        dir.clear();
+    }
+
+    emit q->recoverFinished(success);
+
+    // The root of a failed recovery is emitted before, and deleted only now
+    delete buf;
+}
+
+bool AceTreeJournalBackend::recover(const QString &dir) {
+    Q_D(AceTreeJournalBackend);
+
+    if (d->recoverBuf) {
+        myWarning(__func__) << "an asynchronous recovery is running";
+        return false;
+    }
+
+    if (!checkDir_helper(__func__, dir)) {
+        return false;
+    }
+
+    AceTreeJournalBackendPrivate::RecoverData *rdata = nullptr;
+    if (!d->recover_helper(dir, rdata)) {
+        delete rdata;
+        return false;
+    }
+    d->applyRecoverData(dir, rdata);
+    return true;
+}
+
+bool AceTreeJournalBackend::recoverAsync(const QString &dir) {
+    Q_D(AceTreeJournalBackend);
+    if (d->model || d->recoverBuf) {
+        myWarning(__func__) << "not allowed to recover now";
+        return false;
+    }
+
+    if (!checkDir_helper(__func__, dir)) {
+        return false;
+    }
+
+    // The worker opens files in the directory
     d->dir = dir;
-    d->modelInfo = modelInfo;
+
+    auto buf = new AceTreeJournalBackendPrivate::RecoverTaskBuffer();
+    buf->dir = dir;
+    d->recoverBuf = buf;
+
+    auto task = new Tasks::RecoverTask();
+    task->buf = buf;
+    d->pushTask(task);
+
     return true;
 }
 
+bool AceTreeJournalBackend::isRecovering() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->recoverBuf != nullptr;
+}
+
 bool AceTreeJournalBackend::switchDir(const QString &dir) {
     Q_D(AceTreeJournalBackend);
     if (d->dir.isEmpty()) {
@@ -1593,6 +4164,12 @@ bool AceTreeJournalBackend::switchDir(const QString &dir) {
 
 void AceTreeJournalBackend::setup(AceTreeModel *model) {
     Q_D(AceTreeJournalBackend);
+
+    // Wait for the asynchronous recovery
+    if (d->recoverBuf) {
+        d->finishRecoverTask();
+    }
+
     d->model = model;
     d->setup_helper();
 }
@@ -1607,6 +4184,11 @@ int AceTreeJournalBackend::max() const {
     return d->fsMax;
 }
 
+QPair<int, int> AceTreeJournalBackend::lostSteps() const {
+    Q_D(const AceTreeJournalBackend);
+    return d->lostSteps;
+}
+
 QHash<QString, QString> AceTreeJournalBackend::attributes(int step) const {
     Q_D(const AceTreeJournalBackend);
     if (step <= d->fsMin || step > d->fsMax) {
@@ -1615,11 +4197,36 @@ QHash<QString, QString> AceTreeJournalBackend::attributes(int step) const {
 
     int step2 = step - (d->min + 1);
     if (step2 < 0 || step2 >= d->stack.size()) {
-        return d->fs_getAttributes(step);
+        return d->fs_getCachedAttributes(step);
     }
     return d->stack.at(step2).attrs;
 }
 
+QList<QHash<QString, QString>> AceTreeJournalBackend::attributesRange(int from, int to) const {
+    Q_D(const AceTreeJournalBackend);
+    QList<QHash<QString, QString>> res;
+    if (to < from) {
+        return res;
+    }
+    res.reserve(to - from + 1);
+
+    // Evicted steps are read by segments and cached
+    for (int step = from; step <= to; ++step) {
+        if (step <= d->fsMin || step > d->fsMax) {
+            res.append({});
+            continue;
+        }
+
+        int step2 = step - (d->min + 1);
+        if (step2 < 0 || step2 >= d->stack.size()) {
+            res.append(d->fs_getCachedAttributes(step));
+        } else {
+            res.append(d->stack.at(step2).attrs);
+        }
+    }
+    return res;
+}
+
 bool AceTreeJournalBackend::createWarningFile(const QString &dir) {
     // Write WARNING
     QFile file(QString("%1/WARNING.txt").arg(dir));
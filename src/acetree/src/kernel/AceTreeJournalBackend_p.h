@@ -1,8 +1,10 @@
 #ifndef ACETREEJOURNALBACKEND_P_H
 #define ACETREEJOURNALBACKEND_P_H
 
+#include <QElapsedTimer>
 #include <QFile>
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -11,6 +13,7 @@
 #include "AceTreeJournalBackend.h"
 #include "AceTreeMemBackend_p.h"
 
+#include "journal/IoRing.h"
 #include "journal/Tasks.h"
 
 class AceTreeJournalBackendPrivate : AceTreeMemBackendPrivate {
@@ -24,50 +27,130 @@ public:
     void setup_helper();
 
     int maxCheckPoints;
+    int compactThreshold;
+    int segmentSteps;
+    qint64 segmentBytes;
     QString dir;
 
+    AceTreeJournalBackend::Compression compression;
+    bool lazyLoading;
+    bool ioUring;
+    AceTreeJournalBackend::Durability durability;
+    int syncInterval;
+    bool syncScheduled;
+
     int fsMin;
     int fsMax;
 
+    // Last step before each segment (segments.dat), the last segment is open
+    QVector<int> boundaries;
+    int legacySegments; // Leading segments of fixed size from an older directory
+
+    // Payload bytes of the open segment up to a step, added up while committing in a row
+    qint64 openBytes;
+    int openBytesBegin;
+    int openBytesStep;
+
+    bool isSegmentFull();
+
     struct RecoverData {
         int fsMin;
         int fsMax;
         int fsStep;
         int currentNum;
         size_t maxId;
+        quint32 stepsSeq;
+        int maxSteps;
+        int maxCheckPoints;
+        QVector<int> boundaries;
+        int legacySegments;
+        QVariantHash modelInfo;
+        QPair<int, int> lostSteps;
         AceTreeItem *root;
         QVector<AceTreeItem *> removedItems;
         QVector<Tasks::OpsAndAttrs> backwardData;
         QVector<Tasks::OpsAndAttrs> forwardData;
 
+        RecoverData()
+            : fsMin(0), fsMax(0), fsStep(0), currentNum(0), maxId(0), stepsSeq(0), maxSteps(0),
+              maxCheckPoints(0), legacySegments(0), lostSteps(0, 0), root(nullptr) {
+        }
         ~RecoverData();
     };
     RecoverData *recoverData;
-    Tasks::WriteCkptTask *writeCkptTask;
+
+    // Progress in bytes read and bytes to read
+    using RecoverCallback = std::function<void(qint64, qint64)>;
+
+    // The data is also returned on failure if the reading has started, owned by the caller
+    bool recover_helper(const QString &dir, RecoverData *&res,
+                        const RecoverCallback &progress = nullptr,
+                        const std::function<void(AceTreeItem *)> &rootLoaded = nullptr) const;
+    void applyRecoverData(const QString &dir, RecoverData *rdata);
+
+    struct RecoverTaskBuffer {
+        QString dir;
+        RecoverData *data; // Partly read if failed
+        bool success;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool finished;
+        RecoverTaskBuffer() : data(nullptr), success(false), finished(false) {
+        }
+        ~RecoverTaskBuffer() {
+            delete data;
+        }
+    };
+    RecoverTaskBuffer *recoverBuf;
+
+    void finishRecoverTask();
+    QPair<int, int> lostSteps; // Dropped by recover() due to damaged journals
+    int writeCkptStep; // Step of the checkpoint kept by the worker, -1 if none
 
     QHash<QString, QString> fs_getAttributes(int step) const;
-    QHash<QString, QString> fs_getAttributes_do(int step) const;
+    QHash<QString, QString> fs_getAttributes_do(int num, int cur) const;
+
+    // Attributes of evicted segments, read from the sidecar index (attrs_XXX.dat) at once
+    mutable QHash<int, QVector<QHash<QString, QString>>> attrsCache;
+
+    QHash<QString, QString> fs_getCachedAttributes(int step) const;
+    QVector<QHash<QString, QString>> fs_getAttributesIndex(int num) const;
+    QVector<QHash<QString, QString>> fs_getAttributesIndex_do(int num) const;
 
     static bool readJournal(QFile &file, int maxSteps, QVector<Tasks::OpsAndAttrs> &res,
                             bool brief);
     static bool readCheckPoint(QFile &file, AceTreeItem **rootRef,
-                               QVector<AceTreeItem *> *removedItemsRef);
-    static bool writeCheckPoint(QFile &file, AceTreeItem *root,
-                                const QVector<AceTreeItem *> &removedItems);
+                               QVector<AceTreeItem *> *removedItemsRef, bool lazy = false);
+    static bool writeCheckPoint(QIODevice &file, AceTreeItem *root,
+                                const QVector<AceTreeItem *> &removedItems, int codec);
 
-    Tasks::WriteCkptTask *genWriteCkptTask() const;
+    void pushWriteCkptTask();
 
     void updateStackSize();
 
     bool acceptChangeMaxSteps(int steps) const override;
+    bool acceptCompactHistory() const override;
     void afterModelInfoSet() override;
+    void beforeCurrentChange(bool undo) override;
     void afterCurrentChange() override;
     void afterCommit(const QList<AceTreeEvent *> &events,
                      const QHash<QString, QString> &attributes) override;
     void afterReset() override;
 
-    void abortBackwardReadTask();
-    void abortForwardReadTask();
+    void abortBackwardReadTasks();
+    void abortForwardReadTasks();
+
+    // Undo and redo rates in steps per second, decide how many segments to read ahead
+    QElapsedTimer stepTimer;
+    double undoRate;
+    double redoRate;
+
+    int prefetchSegments(double rate) const;
+    void updateStepRate(bool undo);
+    void prefetchBackward(int segments);
+    void prefetchForward(int segments);
+    void takeBackwardReadTasks(bool wait);
+    void takeForwardReadTasks(bool wait);
 
     void extractBackwardJournal(QVector<AceTreeItem *> &removedItems,
                                 QVector<Tasks::OpsAndAttrs> &data);
@@ -75,10 +158,65 @@ public:
 
     // Worker routine
     void workerRoutine();
-    void pushTask(Tasks::BaseTask *task, bool unshift = false);
+    void writeBatch(const QVector<Tasks::BaseTask *> &batch);
+    void flushFile(QFile &file) const;
+    void writeSteps();
+    void writeSegmentEntry(int num, int begin);
+    void closeJournal();
+    void syncJournal();
+    void compactCheckPoint(int num);
+    void scheduleSync();
+    void pushTask(Tasks::BaseTask *task, bool unshift = false); // Only reads can be unshifted
 
+    // The worker lives until destruction, and parks while there is no task
     std::thread *worker;
-    std::mutex mtx;
+    Tasks::TaskQueue task_queue;
+    std::mutex parkMtx;
+    std::condition_variable parkCv;
+    std::atomic<bool> workerSleeping;
+    std::atomic<bool> workerQuit;
+
+    // Journal, steps and checkpoint writes go in flight while the next tasks are executed, the
+    // writes are done only after them
+    void drainRing();
+    qint64 reapRing(bool block);
+
+    IoRing *ring;                             // Null if unavailable
+    QList<QPair<qint64, qint64>> pendingDone; // Tickets of the ring and the writes done with them
+
+    Tasks::WriteCkptTask *heldCkpt; // Copied by the worker, written when the segment starts
+
+    // Step changes coalesce into one queued task, commits and resets supersede it
+    void supersedeStepTasks();
+
+    std::mutex stepMtx;
+    int latestStep;
+    int stepEpoch;
+    bool stepQueued;
+
+    // Reading lane, a read only waits for the writes of the segments it reads. The reader lives
+    // until destruction, and parks while there is no read
+    void readerRoutine();
+    void executeReadTask(Tasks::BaseTask *task);
+    void pushReadTask(Tasks::BaseTask *task, bool unshift);
+
+    std::thread *reader;
+    std::mutex readMtx;
+    std::condition_variable readCv;
+    std::list<Tasks::BaseTask *> read_queue;
+    bool readerQuit;
+
+    qint64 pushedWrites;
+    qint64 barrierWrites;             // Last write that all reads depend on
+    QHash<int, qint64> segmentWrites; // Last write to the journal or checkpoint of a segment
+
+    std::mutex doneMtx;
+    std::condition_variable doneCv;
+    qint64 doneWrites;
+
+    // The directory is switched by the writing worker
+    mutable std::mutex dirMtx;
+    QString readDir() const;
 
     struct CheckPointTaskBuffer {
         bool brief; // Read only id of insert operation
@@ -92,8 +230,9 @@ public:
         }
         ~CheckPointTaskBuffer();
     };
-    CheckPointTaskBuffer *backward_buf;
-    CheckPointTaskBuffer *forward_buf;
+    // Segments being read, the nearest first
+    QList<CheckPointTaskBuffer *> backward_bufs;
+    QList<CheckPointTaskBuffer *> forward_bufs;
 
     struct AttributesTaskBuffer {
         std::mutex mtx;
@@ -104,6 +243,37 @@ public:
         }
     };
 
+    struct AttributesIndexTaskBuffer {
+        std::mutex mtx;
+        std::condition_variable cv;
+        QVector<QHash<QString, QString>> res;
+        volatile bool finished;
+        AttributesIndexTaskBuffer() : finished(false) {
+        }
+    };
+
+    // Segments copied in background after switching to another file system, the journal goes
+    // on in the target meanwhile and takes a file first if it is needed
+    struct SwitchCopyBuffer {
+        QString source;
+        QString target;
+        QStringList pending; // File names, the latest segments first
+        QStringList copying; // Being copied by the copier or other threads
+        bool active;
+        bool quit;
+        std::mutex mtx;
+        std::condition_variable cv;
+        SwitchCopyBuffer() : active(false), quit(false) {
+        }
+    };
+    SwitchCopyBuffer switchCopy;
+    std::thread *copier;
+
+    void copierRoutine();
+    void claimSwitchFile(const QString &name, bool copy = true);
+    void claimSwitchSegment(int num, bool copy);
+    void finishSwitchCopy();
+
     struct SwitchDirBuffer {
         std::mutex mtx;
         std::condition_variable cv;
@@ -114,13 +284,25 @@ public:
 
     QFile *stepFile;
     QFile *infoFile;
+    QFile *segmentsFile;
     QFile *txFile;
     int txNum;
+    bool txAppend; // Journal file is in append-only format
+    int txCodec;
+    qint64 txEnd;       // Logical end of an append-only journal, the rest is preallocated
+    qint64 txAllocated; // Space reserved for the journal, beyond the file size which is txEnd
+    QFile *attrsFile; // Closed if earlier steps of the segment are not indexed
+    QFile *ckptFile;  // Written through the ring, closed when it drains
+
+    void openAttributesIndex(int num, int cur);
 
     int fsMin2;
     int fsMax2;
     int fsStep2;
-    std::list<Tasks::BaseTask *> task_queue;
+    QVector<int> boundaries2;
+    size_t maxId2;
+    quint32 stepsSeq; // Sequence number of the last slot written
+    bool stepsPending; // Steps not written yet in PeriodicSync mode
 };
 
 #endif // ACETREEJOURNALBACKEND_P_H
@@ -1,47 +1,252 @@
 #include "AceTreeMemBackend.h"
 #include "AceTreeMemBackend_p.h"
 
+#include "AceTreeCompactLog_p.h"
 #include "AceTreeItem_p.h"
 #include "AceTreeModel_p.h"
 
+#include <QElapsedTimer>
+#include <QTimer>
+
+static const qint64 reclaimSlice = 1000000; // 1ms per idle round
+
+static inline qint64 subtreeBytes(const AceTreeItem *item) {
+    return AceTreeItemPrivate::get(item)->subtreeBytes;
+}
+
+static qint64 eventBytes(const AceTreeEvent *e, qint64 &retained) {
+    qint64 size = 0;
+    switch (e->type()) {
+        case AceTreeEvent::PropertyChange: {
+            auto event = static_cast<const AceTreeValueEvent *>(e);
+            size += sizeof(AceTreeValueEvent) +
+                    AceTreeItemPrivate::entryBytes(event->key(), event->value()) +
+                    AceTreeItemPrivate::variantBytes(event->oldValue());
+            break;
+        }
+        case AceTreeEvent::BytesReplace:
+        case AceTreeEvent::BytesInsert:
+        case AceTreeEvent::BytesRemove: {
+            auto event = static_cast<const AceTreeBytesEvent *>(e);
+            size += sizeof(AceTreeBytesEvent) + event->bytes().size() + event->oldBytes().size();
+            break;
+        }
+        case AceTreeEvent::RowsMove: {
+            size += sizeof(AceTreeRowsMoveEvent);
+            break;
+        }
+        case AceTreeEvent::RowsInsert:
+        case AceTreeEvent::RowsRemove: {
+            auto event = static_cast<const AceTreeRowsInsDelEvent *>(e);
+            const auto &children = event->children();
+            size += sizeof(AceTreeRowsInsDelEvent) + children.size() * sizeof(AceTreeItem *);
+            if (e->type() == AceTreeEvent::RowsRemove) {
+                for (const auto &child : children)
+                    retained += subtreeBytes(child);
+            }
+            break;
+        }
+        case AceTreeEvent::RecordAdd:
+        case AceTreeEvent::RecordRemove: {
+            auto event = static_cast<const AceTreeRecordEvent *>(e);
+            size += sizeof(AceTreeRecordEvent);
+            if (e->type() == AceTreeEvent::RecordRemove)
+                retained += subtreeBytes(event->child());
+            break;
+        }
+        case AceTreeEvent::ElementAdd:
+        case AceTreeEvent::ElementRemove: {
+            auto event = static_cast<const AceTreeElementEvent *>(e);
+            size += sizeof(AceTreeElementEvent) + event->key().size() * qint64(sizeof(QChar));
+            if (e->type() == AceTreeEvent::ElementRemove)
+                retained += subtreeBytes(event->child());
+            break;
+        }
+        case AceTreeEvent::RootChange: {
+            auto event = static_cast<const AceTreeRootEvent *>(e);
+            size += sizeof(AceTreeRootEvent);
+            if (event->oldRoot())
+                retained += subtreeBytes(event->oldRoot());
+            break;
+        }
+        default:
+            break;
+    }
+    return size;
+}
+
+static void collectEvent(const AceTreeEvent *e, QVector<AceTreeItem *> &garbage) {
+    // Same as AceTreeEvent::clean(), only free subtrees are collected
+    auto removeIfManaged = [&garbage](AceTreeItem *item) {
+        if (item && item->isManaged() && !item->parent())
+            garbage.append(item);
+    };
+
+    switch (e->type()) {
+        case AceTreeEvent::RowsInsert: {
+            const auto &children = static_cast<const AceTreeRowsInsDelEvent *>(e)->children();
+            for (const auto &child : children)
+                removeIfManaged(child);
+            break;
+        }
+        case AceTreeEvent::RecordAdd:
+            removeIfManaged(static_cast<const AceTreeRecordEvent *>(e)->child());
+            break;
+        case AceTreeEvent::ElementAdd:
+            removeIfManaged(static_cast<const AceTreeElementEvent *>(e)->child());
+            break;
+        case AceTreeEvent::RootChange:
+            removeIfManaged(static_cast<const AceTreeRootEvent *>(e)->root());
+            break;
+        default:
+            break;
+    }
+}
+
 AceTreeMemBackendPrivate::AceTreeMemBackendPrivate() {
     maxSteps = 4;
+    compact = false;
     model = nullptr;
     min = 0;
     current = 0;
+    maxBytes = 0;
+    historyBytes = 0;
+    retainedBytes = 0;
+    reclaimScheduled = false;
 }
 
 AceTreeMemBackendPrivate::~AceTreeMemBackendPrivate() {
     removeEvents(0, stack.size());
+    reclaim();
 }
 
 void AceTreeMemBackendPrivate::init() {
 }
 
-void AceTreeMemBackendPrivate::removeEvents(int b, int e) {
+void AceTreeMemBackendPrivate::removeEvents(int b, int e, bool deferred) {
     if (b >= e) {
         return;
     }
 
+    // Decide which items to free now, the tree may change before they are freed
     auto begin = stack.begin() + b;
     auto end = stack.begin() + e;
     for (auto it = begin; it != end; ++it) {
         AceTreeMemBackendPrivate::TransactionData &tx = *it;
         for (const auto &e : qAsConst(tx.events)) {
-            AceTreeItemPrivate::cleanEvent(e);
-            delete e;
+            collectEvent(e, garbageItems);
+        }
+        garbageEvents.append(tx.events);
+        if (tx.log) {
+            tx.log->collect(AceTreeModelPrivate::get(model), garbageItems);
+            garbageLogs.append(tx.log);
         }
+        historyBytes -= tx.bytes;
+        retainedBytes -= tx.retainedBytes;
     }
     stack.erase(begin, end);
+
+    if (deferred) {
+        scheduleReclaim();
+    } else {
+        reclaim();
+    }
+}
+
+void AceTreeMemBackendPrivate::scheduleReclaim() {
+    Q_Q(AceTreeMemBackend);
+    if (reclaimScheduled) {
+        return;
+    }
+    reclaimScheduled = true;
+
+    QTimer::singleShot(0, q, [this]() {
+        reclaimScheduled = false;
+        if (!reclaim(reclaimSlice)) {
+            scheduleReclaim();
+        }
+    });
+}
+
+bool AceTreeMemBackendPrivate::reclaim(qint64 nsecs) {
+    QElapsedTimer timer;
+    timer.start();
+
+    auto timeout = [&]() {
+        return nsecs >= 0 && timer.nsecsElapsed() > nsecs; //
+    };
+
+    while (!garbageItems.isEmpty()) {
+        AceTreeItemPrivate::forceDeleteItem(garbageItems.takeLast());
+        if (timeout())
+            return false;
+    }
+    while (!garbageEvents.isEmpty()) {
+        delete garbageEvents.takeLast();
+        if (timeout())
+            return false;
+    }
+    while (!garbageLogs.isEmpty()) {
+        delete garbageLogs.takeLast();
+        if (timeout())
+            return false;
+    }
+    return true;
+}
+
+void AceTreeMemBackendPrivate::measure(TransactionData &tx) {
+    qint64 size = sizeof(TransactionData);
+    qint64 retained = 0;
+    for (const auto &e : qAsConst(tx.events)) {
+        auto bytes = eventBytes(e, retained);
+        if (!tx.log)
+            size += sizeof(AceTreeEvent *) + bytes;
+    }
+    if (tx.log) {
+        size += tx.log->bytes();
+    }
+    for (auto it = tx.attrs.begin(); it != tx.attrs.end(); ++it) {
+        size += (it.key().size() + it.value().size()) * qint64(sizeof(QChar));
+    }
+    tx.bytes = size;
+    tx.retainedBytes = retained;
+
+    historyBytes += size;
+    retainedBytes += retained;
+}
+
+void AceTreeMemBackendPrivate::execute(const TransactionData &tx, bool undo) {
+    if (tx.log) {
+        tx.log->execute(AceTreeModelPrivate::get(model), undo);
+        return;
+    }
+
+    if (undo) {
+        for (auto it = tx.events.rbegin(); it != tx.events.rend(); ++it) {
+            AceTreeItemPrivate::executeEvent(*it, true);
+        }
+    } else {
+        for (auto it = tx.events.begin(); it != tx.events.end(); ++it) {
+            AceTreeItemPrivate::executeEvent(*it, false);
+        }
+    }
 }
 
 bool AceTreeMemBackendPrivate::acceptChangeMaxSteps(int steps) const {
     return steps >= 100;
 }
 
+bool AceTreeMemBackendPrivate::acceptCompactHistory() const {
+    return true;
+}
+
 void AceTreeMemBackendPrivate::afterModelInfoSet() {
 }
 
+void AceTreeMemBackendPrivate::beforeCurrentChange(bool undo) {
+    Q_UNUSED(undo);
+}
+
 void AceTreeMemBackendPrivate::afterCurrentChange() {
 }
 
@@ -52,10 +257,24 @@ void AceTreeMemBackendPrivate::afterCommit(const QList<AceTreeEvent *> &events,
 
     if (current > 2 * maxSteps) {
         // Remove head
-        removeEvents(0, maxSteps);
+        removeEvents(0, maxSteps, true);
         min += maxSteps;
         current -= maxSteps;
     }
+
+    // Remove head until the history fits in the memory budget, always keep the last one
+    if (maxBytes > 0 && historyBytes + retainedBytes > maxBytes) {
+        qint64 bytes = historyBytes + retainedBytes;
+        int cnt = 0;
+        while (cnt < current - 1 && bytes > maxBytes) {
+            const auto &tx = stack.at(cnt);
+            bytes -= tx.bytes + tx.retainedBytes;
+            cnt++;
+        }
+        removeEvents(0, cnt, true);
+        min += cnt;
+        current -= cnt;
+    }
 }
 
 void AceTreeMemBackendPrivate::afterReset() {
@@ -86,6 +305,34 @@ void AceTreeMemBackend::setMaxReservedSteps(int steps) {
     d->maxSteps = steps;
 }
 
+bool AceTreeMemBackend::compactHistory() const {
+    Q_D(const AceTreeMemBackend);
+    return d->compact;
+}
+
+void AceTreeMemBackend::setCompactHistory(bool compact) {
+    Q_D(AceTreeMemBackend);
+    if (d->model) {
+        return; // Not allowed to change after setup
+    }
+
+    if (compact && !d->acceptCompactHistory()) {
+        return;
+    }
+
+    d->compact = compact;
+}
+
+qint64 AceTreeMemBackend::maxReservedBytes() const {
+    Q_D(const AceTreeMemBackend);
+    return d->maxBytes;
+}
+
+void AceTreeMemBackend::setMaxReservedBytes(qint64 bytes) {
+    Q_D(AceTreeMemBackend);
+    d->maxBytes = qMax(bytes, qint64(0));
+}
+
 void AceTreeMemBackend::setup(AceTreeModel *model) {
     Q_D(AceTreeMemBackend);
     d->model = model;
@@ -127,15 +374,13 @@ QHash<QString, QString> AceTreeMemBackend::attributes(int step) const {
 
 void AceTreeMemBackend::undo() {
     Q_D(AceTreeMemBackend);
+    d->beforeCurrentChange(true);
 
     if (d->current == 0)
         return;
 
     // Step backward
-    const auto &tx = d->stack.at(d->current - 1);
-    for (auto it = tx.events.rbegin(); it != tx.events.rend(); ++it) {
-        AceTreeItemPrivate::executeEvent(*it, true);
-    }
+    d->execute(d->stack.at(d->current - 1), true);
     d->current--;
 
     d->afterCurrentChange();
@@ -143,14 +388,13 @@ void AceTreeMemBackend::undo() {
 
 void AceTreeMemBackend::redo() {
     Q_D(AceTreeMemBackend);
+    d->beforeCurrentChange(false);
+
     if (d->current == d->stack.size())
         return;
 
     // Step forward
-    const auto &tx = d->stack.at(d->current);
-    for (auto it = tx.events.begin(); it != tx.events.end(); ++it) {
-        AceTreeItemPrivate::executeEvent(*it, false);
-    }
+    d->execute(d->stack.at(d->current), false);
     d->current++;
 
     d->afterCurrentChange();
@@ -162,14 +406,31 @@ void AceTreeMemBackend::commit(const QList<AceTreeEvent *> &events,
 
     // Truncate tail
     if (d->current < d->stack.size()) {
-        d->removeEvents(d->current, d->stack.size());
+        d->removeEvents(d->current, d->stack.size(), true);
     }
 
     // Commit
-    d->stack.append({events, attrs});
+    AceTreeMemBackendPrivate::TransactionData tx{events, attrs, 0, 0, nullptr};
+    if (d->compact) {
+        tx.log = new AceTreeCompactLog();
+        for (const auto &e : events) {
+            tx.log->append(e);
+        }
+        tx.log->squeeze();
+    }
+    d->measure(tx);
+    if (tx.log) {
+        tx.events.clear();
+    }
+    d->stack.append(tx);
     d->current++;
 
     d->afterCommit(events, attrs);
+
+    // Events are no longer needed
+    if (d->compact) {
+        qDeleteAll(events);
+    }
 }
 
 void AceTreeMemBackend::reset() {
@@ -194,11 +455,22 @@ void AceTreeMemBackend::reset() {
 
     model_d->is_clearing = false;
     model_d->indexes.clear();
+    model_d->stubs.clear();
     model_d->maxIndex = 0;
 
     d->afterReset();
 }
 
+qint64 AceTreeMemBackend::historyMemoryUsage() const {
+    Q_D(const AceTreeMemBackend);
+    return d->historyBytes;
+}
+
+qint64 AceTreeMemBackend::retainedMemoryUsage() const {
+    Q_D(const AceTreeMemBackend);
+    return d->retainedBytes;
+}
+
 AceTreeMemBackend::AceTreeMemBackend(AceTreeMemBackendPrivate &d, QObject *parent)
     : AceTreeBackend(parent), d_ptr(&d) {
     d.q_ptr = this;
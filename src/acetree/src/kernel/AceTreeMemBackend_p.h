@@ -3,6 +3,8 @@
 
 #include "AceTreeMemBackend.h"
 
+class AceTreeCompactLog;
+
 class AceTreeMemBackendPrivate {
     Q_DECLARE_PUBLIC(AceTreeMemBackend)
 public:
@@ -14,6 +16,7 @@ public:
     AceTreeMemBackend *q_ptr;
 
     int maxSteps;
+    bool compact;
 
     AceTreeModel *model;
     QVariantHash modelInfo;
@@ -21,15 +24,35 @@ public:
     struct TransactionData {
         QList<AceTreeEvent *> events;
         QHash<QString, QString> attrs;
+        qint64 bytes;         // Event payloads
+        qint64 retainedBytes; // Removed items kept alive by the events
+        AceTreeCompactLog *log; // Replaces events if compact history is enabled
     };
     QVector<TransactionData> stack;
     int min;
     int current;
 
-    void removeEvents(int begin, int end);
+    qint64 maxBytes;
+    qint64 historyBytes;
+    qint64 retainedBytes;
+
+    // Evicted transactions, freed incrementally when the event loop is idle
+    QList<AceTreeEvent *> garbageEvents;
+    QVector<AceTreeCompactLog *> garbageLogs;
+    QVector<AceTreeItem *> garbageItems;
+    bool reclaimScheduled;
+
+    void removeEvents(int begin, int end, bool deferred = false);
+    void scheduleReclaim();
+    bool reclaim(qint64 nsecs = -1); // Free garbage for at most nsecs, return true if done
+
+    void measure(TransactionData &tx);
+    void execute(const TransactionData &tx, bool undo);
 
     virtual bool acceptChangeMaxSteps(int steps) const;
+    virtual bool acceptCompactHistory() const;
     virtual void afterModelInfoSet();
+    virtual void beforeCurrentChange(bool undo);
     virtual void afterCurrentChange();
     virtual void afterCommit(const QList<AceTreeEvent *> &events,
                              const QHash<QString, QString> &attributes);
@@ -1,6 +1,12 @@
 #include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QSignalSpy>
+#include <QTemporaryDir>
 #include <QTest>
 
+#include <AceTreeJournalBackend.h>
+#include <AceTreeMemBackend.h>
 #include <AceTreeModel.h>
 
 static AceTreeItem *createItem(const QString &name) {
@@ -9,19 +15,96 @@ static AceTreeItem *createItem(const QString &name) {
     return item;
 }
 
+// CRC-32C of the journal records
+static quint32 crc32c(const QByteArray &data, quint32 crc = 0) {
+    crc = ~crc;
+    for (auto c : data) {
+        crc ^= uchar(c);
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+// Journal tests run with and without io_uring by the global data
+static AceTreeJournalBackend *createBackend() {
+    QFETCH_GLOBAL(bool, ioUring);
+
+    auto backend = new AceTreeJournalBackend();
+    backend->setIoUring(ioUring);
+    return backend;
+}
+
+// A root and steps 2 to count setting its value, all segments are kept if they are limited
+static bool writeJournal(const QString &dir, int count, int segmentSteps = 0) {
+    auto backend = createBackend();
+    if (segmentSteps > 0) {
+        backend->setMaxReservedSteps(100);
+        backend->setReservedCheckPoints(-1);
+        backend->setSegmentSteps(segmentSteps);
+    }
+    if (!backend->start(dir)) {
+        delete backend;
+        return false;
+    }
+
+    AceTreeModel model(backend);
+
+    model.beginTransaction();
+    model.setRootItem(createItem("root"));
+    model.commitTransaction();
+
+    auto rootItem = model.rootItem();
+    for (int i = 2; i <= count; ++i) {
+        model.beginTransaction();
+        rootItem->setProperty("value", i);
+        model.commitTransaction();
+    }
+    return true;
+}
+
 class tst_Basic : public QObject {
     Q_OBJECT
 public:
     Q_INVOKABLE void init();
 
 private slots:
+    void initTestCase_data();
+
     void basic();
+    void memoryUsage();
+    void compactHistory();
+    void journalRecover_data();
+    void journalRecover();
+    void journalDamaged();
+    void journalPreallocated();
+    void journalTornSteps();
+    void journalLazy();
+    void journalRecoverAsync();
+    void journalRecoverAsyncFailed();
+    void journalAttributes();
+    void journalCompaction();
+    void journalSegments_data();
+    void journalSegments();
+    void journalSwitchDir();
+    void journalSwitchInterrupted_data();
+    void journalSwitchInterrupted();
+
 };
 
 void tst_Basic::init() {
     // Initialize
 }
 
+void tst_Basic::initTestCase_data() {
+    // Journal tests run with blocking writes and io_uring, the same if it is not built
+    QTest::addColumn<bool>("ioUring");
+
+    QTest::newRow("blocking") << false;
+    QTest::newRow("io_uring") << true;
+}
+
 void tst_Basic::basic() {
     AceTreeModel model;
 
@@ -57,5 +140,723 @@ void tst_Basic::basic() {
     QCOMPARE(rootItem->bytes(), "340000ABCDEF");
 }
 
-QTEST_APPLESS_MAIN(tst_Basic)
+void tst_Basic::memoryUsage() {
+    AceTreeModel model;
+
+    auto rootItem = createItem("root");
+
+    model.beginTransaction();
+    model.setRootItem(rootItem);
+    model.commitTransaction();
+
+    model.beginTransaction();
+    auto child = createItem("child");
+    child->appendBytes(QByteArray(1024, 'a'));
+    rootItem->appendRow(child);
+    rootItem->addElement("element", createItem("element"));
+    int seq = rootItem->addRecord(createItem("record"));
+    model.commitTransaction();
+
+    // Incremental accounting should match a fresh calculation
+    QScopedPointer<AceTreeItem> copy(rootItem->clone());
+    QCOMPARE(rootItem->subtreeMemoryUsage(), copy->subtreeMemoryUsage());
+    QCOMPARE(model.memoryUsage(), rootItem->subtreeMemoryUsage());
+    QVERIFY(child->memoryUsage() >= 1024);
+
+    auto size = rootItem->subtreeMemoryUsage();
+    model.beginTransaction();
+    rootItem->removeRow(child);
+    rootItem->removeRecord(seq);
+    model.commitTransaction();
+    QCOMPARE(rootItem->subtreeMemoryUsage(),
+             QScopedPointer<AceTreeItem>(rootItem->clone())->subtreeMemoryUsage());
+    QVERIFY(rootItem->subtreeMemoryUsage() < size - 1024);
+
+    // Removed items are retained by the history
+    QVERIFY(model.backend()->retainedMemoryUsage() >= child->subtreeMemoryUsage());
+
+    model.previousStep();
+    QCOMPARE(rootItem->subtreeMemoryUsage(), size);
+}
+
+void tst_Basic::compactHistory() {
+    auto backend = new AceTreeMemBackend();
+    backend->setCompactHistory(true);
+
+    AceTreeModel model(backend);
+    QVERIFY(backend->compactHistory());
+
+    auto rootItem = createItem("root");
+    model.beginTransaction();
+    model.setRootItem(rootItem);
+    model.commitTransaction();
+
+    model.beginTransaction();
+    auto child1 = createItem("1");
+    auto child2 = createItem("2");
+    rootItem->appendRows({child1, child2});
+    rootItem->moveRows(0, 1, 2);
+    rootItem->addElement("element", createItem("element"));
+    int seq = rootItem->addRecord(createItem("record"));
+    rootItem->setProperty("key", "value");
+    rootItem->appendBytes("12345678");
+    rootItem->replaceBytes(4, "ABCDEFGH");
+    model.commitTransaction();
+
+    model.beginTransaction();
+    rootItem->removeRow(child1);
+    rootItem->removeRecord(seq);
+    model.commitTransaction();
+
+    model.previousStep();
+    QCOMPARE(rootItem->rows(), QVector<AceTreeItem *>({child2, child1}));
+    QVERIFY(rootItem->record(seq));
+
+    model.previousStep();
+    QCOMPARE(rootItem->rowCount(), 0);
+    QCOMPARE(rootItem->recordCount(), 0);
+    QCOMPARE(rootItem->elementCount(), 0);
+    QVERIFY(!rootItem->property("key").isValid());
+    QVERIFY(rootItem->bytes().isEmpty());
+
+    model.nextStep();
+    QCOMPARE(rootItem->rows(), QVector<AceTreeItem *>({child2, child1}));
+    QCOMPARE(rootItem->element("element")->property("name").toString(), "element");
+    QCOMPARE(rootItem->property("key").toString(), "value");
+    QCOMPARE(rootItem->bytes(), "1234ABCDEFGH");
+
+    model.nextStep();
+    QCOMPARE(rootItem->rows(), QVector<AceTreeItem *>({child2}));
+
+    model.previousStep();
+    model.previousStep();
+    model.previousStep();
+    QVERIFY(!model.rootItem());
+}
+
+void tst_Basic::journalRecover_data() {
+    QTest::addColumn<int>("compression");
+
+    QTest::newRow("none") << int(AceTreeJournalBackend::NoCompression);
+    QTest::newRow("zlib") << int(AceTreeJournalBackend::ZlibCompression);
+}
+
+void tst_Basic::journalRecover() {
+    QFETCH(int, compression);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    {
+        auto backend = createBackend();
+        backend->setCompression(AceTreeJournalBackend::Compression(compression));
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.commitTransaction();
+
+        auto rootItem = model.rootItem();
+        for (int i = 1; i <= 2; ++i) {
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            model.commitTransaction({
+                {"name", QString::number(i)}
+            });
+        }
+
+        // Discard step 3 and commit again, across journal segments
+        model.previousStep();
+        for (int i = 3; i <= 9; ++i) {
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            model.commitTransaction({
+                {"name", QString::number(i)}
+            });
+        }
+
+        model.previousStep();
+        model.previousStep();
+        QCOMPARE(model.currentStep(), 7);
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.maxStep(), 9);
+    QCOMPARE(model.currentStep(), 7);
+    QCOMPARE(model.rootItem()->property("value").toInt(), 7);
+    QCOMPARE(model.stepAttributes(3).value("name"), "3");
+
+    model.nextStep();
+    model.nextStep();
+    QCOMPARE(model.rootItem()->property("value").toInt(), 9);
+}
+
+void tst_Basic::journalDamaged() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writeJournal(dir.path(), 6));
+
+    // Corrupt the last transaction
+    {
+        QFile file(dir.filePath("journal_1.dat"));
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        file.seek(file.size() - 1);
+        char c;
+        QVERIFY(file.getChar(&c));
+        file.seek(file.size() - 1);
+        QVERIFY(file.putChar(char(~c)));
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+    QCOMPARE(backend->lostSteps(), qMakePair(6, 6));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.maxStep(), 5);
+    QCOMPARE(model.currentStep(), 5);
+    QCOMPARE(model.rootItem()->property("value").toInt(), 5);
+
+    // Journal can be continued
+    model.beginTransaction();
+    model.rootItem()->setProperty("value", 7);
+    model.commitTransaction();
+    QCOMPARE(model.currentStep(), 6);
+}
+
+void tst_Basic::journalPreallocated() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writeJournal(dir.path(), 2));
+
+    // Trimmed on close, leave a preallocated tail as after a crash
+    qint64 size;
+    {
+        QFile file(dir.filePath("journal_0.dat"));
+        size = file.size();
+        QVERIFY(size < 1024 * 1024);
+        QVERIFY(file.open(QIODevice::Append));
+        file.write(QByteArray(64 * 1024, 0));
+    }
+
+    {
+        auto backend = createBackend();
+        QVERIFY(backend->recover(dir.path()));
+        QCOMPARE(backend->lostSteps(), qMakePair(0, 0));
+        QCOMPARE(QFileInfo(dir.filePath("journal_0.dat")).size(), size);
+
+        AceTreeModel model(backend);
+        QCOMPARE(model.rootItem()->property("value").toInt(), 2);
+
+        // Appended after the logical end
+        model.beginTransaction();
+        model.rootItem()->setProperty("value", 3);
+        model.commitTransaction();
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.currentStep(), 3);
+    QCOMPARE(model.rootItem()->property("value").toInt(), 3);
+}
+
+void tst_Basic::journalTornSteps() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writeJournal(dir.path(), 3));
+
+    {
+        auto backend = createBackend();
+        QVERIFY(backend->recover(dir.path()));
+
+        AceTreeModel model(backend);
+
+        // Scrub through the history
+        for (int i = 0; i < 10; ++i) {
+            model.previousStep();
+            model.previousStep();
+            model.nextStep();
+        }
+    }
+
+    // Tear the latest of the two slots (sequence, min, max, current)
+    int maxStep;
+    int currentStep;
+    {
+        QFile file(dir.filePath("model_steps.dat"));
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QDataStream stream(&file);
+
+        quint32 seq[2];
+        qint32 steps[2][3];
+        for (int i = 0; i < 2; ++i) {
+            file.seek(0x10 + i * 0x20);
+            stream >> seq[i] >> steps[i][0] >> steps[i][1] >> steps[i][2];
+        }
+        int latest = seq[1] > seq[0] ? 1 : 0;
+        maxStep = steps[1 - latest][1];
+        currentStep = steps[1 - latest][2];
+
+        file.seek(0x10 + latest * 0x20 + 12);
+        stream << qint32(~steps[latest][2]);
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.maxStep(), maxStep);
+    QCOMPARE(model.currentStep(), currentStep);
+}
+
+void tst_Basic::journalLazy() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    size_t nestedIndex;
+    {
+        auto backend = createBackend();
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        // Large enough to be split in the checkpoint
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        auto rootItem = model.rootItem();
+        for (int i = 0; i < 16; ++i) {
+            auto child = createItem(QString::number(i));
+            child->appendBytes(QByteArray(1 << 16, char(i)));
+            child->addRecord(createItem("nested"));
+            rootItem->appendRow(child);
+        }
+        model.commitTransaction();
+        nestedIndex = rootItem->row(5)->record(1)->index();
+
+        for (int i = 0; i < backend->maxReservedSteps(); ++i) {
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            model.commitTransaction();
+        }
+    }
+
+    auto backend = createBackend();
+    backend->setLazyLoading(true);
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    auto rootItem = model.rootItem();
+    QCOMPARE(rootItem->rowCount(), 16);
+
+    // A missing index loads no stub, the usage is still the estimation
+    auto usage = rootItem->subtreeMemoryUsage();
+    QVERIFY(!model.itemFromIndex(nestedIndex + 1000000));
+    QCOMPARE(rootItem->subtreeMemoryUsage(), usage);
+
+    // Items inside a stub are found by index
+    auto nested = model.itemFromIndex(nestedIndex);
+    QVERIFY(nested);
+    QVERIFY(rootItem->subtreeMemoryUsage() != usage);
+    QCOMPARE(nested->property("name").toString(), "nested");
+    QCOMPARE(nested->parent(), rootItem->row(5));
+    QCOMPARE(nested->parent()->bytesSize(), 1 << 16);
+
+    auto child = rootItem->row(3);
+    QCOMPARE(child->property("name").toString(), "3");
+    QCOMPARE(child->recordCount(), 1);
+
+    model.beginTransaction();
+    child->setProperty("value", 3);
+    model.commitTransaction();
+    model.previousStep();
+    QVERIFY(!child->property("value").isValid());
+}
+
+void tst_Basic::journalRecoverAsync() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writeJournal(dir.path(), 6));
+
+    auto backend = createBackend();
+    QSignalSpy progress(backend, &AceTreeJournalBackend::recoverProgress);
+    QSignalSpy finished(backend, &AceTreeJournalBackend::recoverFinished);
+    QSignalSpy rootLoaded(backend, &AceTreeJournalBackend::recoverRootLoaded);
+    QVERIFY(backend->recoverAsync(dir.path()));
+    QVERIFY(backend->isRecovering());
+
+    QVERIFY(finished.wait());
+    QCOMPARE(finished.first().first().toBool(), true);
+    QVERIFY(!backend->isRecovering());
+    QVERIFY(!progress.isEmpty());
+    QCOMPARE(progress.last().at(0), progress.last().at(1));
+    QCOMPARE(rootLoaded.size(), 1);
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.currentStep(), 6);
+    QCOMPARE(model.rootItem()->property("value").toInt(), 6);
+}
+
+void tst_Basic::journalRecoverAsyncFailed() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writeJournal(dir.path(), 6));
+
+    // Replace the last transaction of the forward journal with one that passes the checksum but
+    // fails to read, after the checkpoint is read
+    {
+        QFile file(dir.filePath("journal_1.dat"));
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QDataStream in(&file);
+
+        qint64 pos = 8; // Header
+        qint32 step = 0;
+        qint32 size = 0;
+        while (pos < file.size()) {
+            file.seek(pos);
+            in >> step >> size;
+            if (pos + 12 + qMax(size, 0) >= file.size())
+                break;
+            pos += 12 + qMax(size, 0);
+        }
+        QVERIFY(size >= 8);
+
+        QByteArray data;
+        {
+            QDataStream out(&data, QIODevice::WriteOnly);
+            out << qint32(0) << qint32(-1); // No attributes, negative operation count
+        }
+        data.append(QByteArray(size - data.size(), 0));
+
+        QByteArray header;
+        {
+            QDataStream out(&header, QIODevice::WriteOnly);
+            out << step << size;
+        }
+
+        file.seek(pos + 8);
+        QDataStream out(&file);
+        out << crc32c(data, crc32c(header));
+        QCOMPARE(file.write(data), qint64(data.size()));
+    }
+
+    // The root is handed out once the checkpoint is read, and deleted after the failure is emitted
+    auto backend = createBackend();
+    QStringList events;
+    const AceTreeItem *root = nullptr;
+    QString rootName;
+    connect(backend, &AceTreeJournalBackend::recoverRootLoaded, this,
+            [&](const AceTreeItem *item) {
+                events.append("rootLoaded");
+                root = item;
+            });
+    connect(backend, &AceTreeJournalBackend::recoverFinished, this, [&](bool success) {
+        events.append(success ? "succeeded" : "failed");
+        if (root) {
+            rootName = root->property("name").toString();
+        }
+    });
+
+    QSignalSpy finished(backend, &AceTreeJournalBackend::recoverFinished);
+    QVERIFY(backend->recoverAsync(dir.path()));
+    QVERIFY(finished.wait());
+    QCOMPARE(events, QStringList({"rootLoaded", "failed"}));
+    QCOMPARE(rootName, QString("root"));
+    delete backend;
+}
+
+void tst_Basic::journalAttributes() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const int count = 20;
+    {
+        auto backend = createBackend();
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.commitTransaction({
+            {"name", "1"}
+        });
+
+        auto rootItem = model.rootItem();
+        for (int i = 2; i <= count; ++i) {
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            model.commitTransaction({
+                {"name", QString::number(i)}
+            });
+        }
+
+        // Evicted steps are listed in a batch
+        auto list = model.stepAttributes(1, count);
+        QCOMPARE(list.size(), count);
+        for (int i = 0; i < count; ++i) {
+            QCOMPARE(list.at(i).value("name"), QString::number(i + 1));
+        }
+    }
+
+    // Segments without an index are read from the journal
+    QVERIFY(QFile::exists(dir.filePath("attrs_1.dat")));
+    QVERIFY(QFile::remove(dir.filePath("attrs_1.dat")));
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    auto list = model.stepAttributes(0, count + 1);
+    QCOMPARE(list.size(), count + 2);
+    QVERIFY(list.first().isEmpty());
+    QVERIFY(list.last().isEmpty());
+    for (int i = 1; i <= count; ++i) {
+        QCOMPARE(list.at(i).value("name"), QString::number(i));
+    }
+}
+
+void tst_Basic::journalCompaction() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const int count = 40;
+    int min;
+    {
+        auto backend = createBackend();
+        backend->setReservedCheckPoints(-1);
+        backend->setCompactThreshold(4);
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.commitTransaction();
+
+        auto rootItem = model.rootItem();
+        for (int i = 2; i <= count; ++i) {
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            rootItem->appendRow(createItem(QString::number(i)));
+            if (i % 3 == 0) {
+                rootItem->removeRows(0, 1);
+            }
+            model.commitTransaction();
+        }
+
+        // Unlimited history is folded
+        min = backend->min();
+        QVERIFY(min > 0);
+        QVERIFY(!QFile::exists(dir.filePath("journal_0.dat")));
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    QCOMPARE(backend->min(), min);
+    QCOMPARE(model.rootItem()->property("value").toInt(), count);
+
+    // Undo down to the base checkpoint
+    while (model.currentStep() > min) {
+        model.previousStep();
+    }
+    QCOMPARE(model.rootItem()->property("value").toInt(), min);
+    while (model.currentStep() < count) {
+        model.nextStep();
+    }
+    QCOMPARE(model.rootItem()->property("value").toInt(), count);
+}
+
+void tst_Basic::journalSegments_data() {
+    QTest::addColumn<int>("steps");
+    QTest::addColumn<int>("bytes");
+    QTest::addColumn<int>("segments");
+    QTest::addColumn<bool>("exact");
+
+    // A transaction carries a bit more than 1KB
+    QTest::newRow("steps") << 10 << 0 << 4 << true;
+    QTest::newRow("bytes") << 0 << 4096 << 8 << false;
+}
+
+void tst_Basic::journalSegments() {
+    QFETCH(int, steps);
+    QFETCH(int, bytes);
+    QFETCH(int, segments);
+    QFETCH(bool, exact);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const int count = 40;
+    {
+        auto backend = createBackend();
+        backend->setMaxReservedSteps(100);
+        backend->setReservedCheckPoints(-1);
+        backend->setSegmentSteps(steps);
+        backend->setSegmentBytes(bytes);
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.rootItem()->setProperty("value", 1);
+        model.commitTransaction();
+
+        auto rootItem = model.rootItem();
+        for (int i = 2; i <= count; ++i) {
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            rootItem->appendBytes(QByteArray(1024, char(i)));
+            model.commitTransaction();
+        }
+    }
+
+    // Rotated regardless of the steps kept in memory
+    QVERIFY(QFile::exists(dir.filePath("segments.dat")));
+    QVERIFY(QFile::exists(dir.filePath(QString("journal_%1.dat").arg(segments - 1))));
+    if (exact) {
+        QVERIFY(!QFile::exists(dir.filePath(QString("journal_%1.dat").arg(segments))));
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir.path()));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.rootItem()->property("value").toInt(), count);
+
+    // Go through all segments in both directions
+    while (model.currentStep() > 1) {
+        model.previousStep();
+    }
+    QCOMPARE(model.rootItem()->property("value").toInt(), 1);
+    while (model.currentStep() < count) {
+        model.nextStep();
+    }
+    QCOMPARE(model.rootItem()->property("value").toInt(), count);
+    QCOMPARE(model.rootItem()->bytes().size(), (count - 1) * 1024);
+}
+
+void tst_Basic::journalSwitchDir() {
+    QTemporaryDir dir;
+    QTemporaryDir dir2;
+    QVERIFY(dir.isValid());
+    QVERIFY(dir2.isValid());
+
+    const int count = 10;
+    {
+        auto backend = createBackend();
+        backend->setMaxReservedSteps(100);
+        backend->setReservedCheckPoints(-1);
+        backend->setSegmentSteps(3);
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.commitTransaction();
+
+        // Switch in the middle, the journal goes on in the target
+        auto rootItem = model.rootItem();
+        for (int i = 2; i <= count; ++i) {
+            if (i == 6) {
+                QVERIFY(backend->switchDir(dir2.path()));
+            }
+            model.beginTransaction();
+            rootItem->setProperty("value", i);
+            model.commitTransaction({
+                {"name", QString::number(i)}
+            });
+        }
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(dir2.path()));
+    QVERIFY(!QFile::exists(dir2.filePath("switch.lock")));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.currentStep(), count);
+    QCOMPARE(model.rootItem()->property("value").toInt(), count);
+    QCOMPARE(model.stepAttributes(4).value("name"), "4");
+    QCOMPARE(model.stepAttributes(8).value("name"), "8");
+
+    // Steps before the switch are read from the target
+    while (model.currentStep() > 2) {
+        model.previousStep();
+    }
+    QCOMPARE(model.rootItem()->property("value").toInt(), 2);
+}
+
+void tst_Basic::journalSwitchInterrupted_data() {
+    QTest::addColumn<bool>("fromSource");
+
+    QTest::newRow("target") << false;
+    QTest::newRow("source") << true;
+}
+
+void tst_Basic::journalSwitchInterrupted() {
+    QFETCH(bool, fromSource);
+
+    QTemporaryDir source;
+    QTemporaryDir target;
+    QVERIFY(source.isValid());
+    QVERIFY(target.isValid());
+
+    const int count = 12;
+    QVERIFY(writeJournal(source.path(), count, 3));
+
+    // As if the background copy stopped before an older segment, the journal goes on in the target
+    const QString missing = "journal_1.dat";
+    QVERIFY(QFile::exists(source.filePath(missing)));
+    for (const auto &info : QDir(source.path()).entryInfoList(QDir::Files)) {
+        if (info.fileName() != missing) {
+            QVERIFY(QFile::copy(info.filePath(), target.filePath(info.fileName())));
+        }
+    }
+
+    auto writeLock = [](const QString &dir, const QString &other, const QString &role) {
+        QFile file(QString("%1/switch.lock").arg(dir));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            return false;
+        }
+        file.write(QString("%1\n%2\n").arg(other, role).toUtf8());
+        return true;
+    };
+    QVERIFY(writeLock(target.path(), source.path(), "target-incremental"));
+    QVERIFY(writeLock(source.path(), target.path(), "source"));
+
+    // The source reports the move, the copy is finished by either side
+    if (fromSource) {
+        auto backend = createBackend();
+        QVERIFY(!backend->recover(source.path()));
+        delete backend;
+        QVERIFY(!QFileInfo::exists(source.path()));
+    }
+
+    auto backend = createBackend();
+    QVERIFY(backend->recover(target.path()));
+    QVERIFY(QFile::exists(target.filePath(missing)));
+    QVERIFY(!QFile::exists(target.filePath("switch.lock")));
+    QVERIFY(!QFileInfo::exists(source.path()));
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.currentStep(), count);
+    QCOMPARE(model.rootItem()->property("value").toInt(), count);
+
+    // Through the copied segment
+    while (model.currentStep() > 2) {
+        model.previousStep();
+    }
+    QCOMPARE(model.rootItem()->property("value").toInt(), 2);
+}
+
+QTEST_GUILESS_MAIN(tst_Basic)
 #include "tst_Basic.moc"
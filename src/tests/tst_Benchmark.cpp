@@ -0,0 +1,444 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QThread>
+
+#include <AceTreeJournalBackend.h>
+#include <AceTreeMemBackend.h>
+#include <AceTreeModel.h>
+
+static AceTreeItem *createItem(const QString &name) {
+    auto item = new AceTreeItem();
+    item->setProperty("name", name);
+    return item;
+}
+
+static AceTreeItem *createTree(int count) {
+    auto item = createItem("tree");
+    for (int i = 0; i < count; ++i) {
+        auto child = createItem(QString::number(i));
+        child->setProperty("value", i);
+        child->appendBytes(QByteArray(16, char(i)));
+        item->addRecord(child);
+    }
+    return item;
+}
+
+class tst_Benchmark : public QObject {
+    Q_OBJECT
+public:
+    Q_INVOKABLE void init();
+
+private slots:
+    void commitLatency_data();
+    void commitLatency();
+
+    void commitThroughput_data();
+    void commitThroughput();
+
+    void durableLatency_data();
+    void durableLatency();
+
+    void undoRedoLatency_data();
+    void undoRedoLatency();
+
+    void historyMemory_data();
+    void historyMemory();
+
+    void recoveryTime_data();
+    void recoveryTime();
+
+    void workerLatency_data();
+    void workerLatency();
+
+    void scrubThroughput_data();
+    void scrubThroughput();
+};
+
+void tst_Benchmark::init() {
+    // Initialize
+}
+
+void tst_Benchmark::commitLatency_data() {
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("rotate");
+
+    QTest::newRow("10") << 10 << false;
+    QTest::newRow("1000") << 1000 << false;
+    QTest::newRow("100000") << 100000 << false;
+    QTest::newRow("1000-rotate") << 1000 << true;
+    QTest::newRow("100000-rotate") << 100000 << true;
+}
+
+void tst_Benchmark::commitLatency() {
+    QFETCH(int, count);
+    QFETCH(bool, rotate);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    auto backend = new AceTreeJournalBackend();
+    QVERIFY(backend->start(dir.path()));
+
+    AceTreeModel model(backend);
+
+    model.beginTransaction();
+    model.setRootItem(createItem("root"));
+    model.commitTransaction();
+
+    if (rotate) {
+        model.beginTransaction();
+        model.rootItem()->appendRow(createTree(count));
+        model.commitTransaction();
+
+        // Small edits of a large document crossing segment boundaries, the slowest one is
+        // measured, which prepares the checkpoint
+        const int times = 2 * backend->maxReservedSteps();
+        qint64 elapsed = 0;
+        for (int i = 0; i < times; ++i) {
+            model.beginTransaction();
+            model.rootItem()->setProperty("value", i);
+
+            QElapsedTimer timer;
+            timer.start();
+            model.commitTransaction();
+            elapsed = qMax(elapsed, timer.nsecsElapsed());
+        }
+
+        QTest::setBenchmarkResult(qreal(elapsed) / 1000000, QTest::WalltimeMilliseconds);
+        return;
+    }
+
+    // Only the commit itself is measured, the subtree is built outside
+    const int times = 10;
+    qint64 elapsed = 0;
+    for (int i = 0; i < times; ++i) {
+        model.beginTransaction();
+        model.rootItem()->appendRow(createTree(count));
+
+        QElapsedTimer timer;
+        timer.start();
+        model.commitTransaction();
+        elapsed += timer.nsecsElapsed();
+    }
+
+    QTest::setBenchmarkResult(qreal(elapsed) / times / 1000000, QTest::WalltimeMilliseconds);
+}
+
+static void addDurabilityColumns(const QList<int> &counts) {
+    QTest::addColumn<int>("count");
+    QTest::addColumn<int>("durability");
+    QTest::addColumn<bool>("ioUring");
+
+    const QList<QPair<const char *, AceTreeJournalBackend::Durability>> modes{
+        {"none",     AceTreeJournalBackend::NoSync      },
+        {"flush",    AceTreeJournalBackend::Flush       },
+        {"datasync", AceTreeJournalBackend::DataSync    },
+        {"periodic", AceTreeJournalBackend::PeriodicSync},
+    };
+    for (const auto &count : counts) {
+        for (const auto &mode : modes) {
+            QTest::newRow(qPrintable(QString("%1-%2").arg(QString::number(count), mode.first)))
+                << count << int(mode.second) << false;
+            QTest::newRow(
+                qPrintable(QString("%1-%2-io_uring").arg(QString::number(count), mode.first)))
+                << count << int(mode.second) << true;
+        }
+    }
+}
+
+// Commit a number of small transactions, the time includes waiting for the journal worker
+static qint64 runCommits(const QString &path, int count, int durability, bool ioUring) {
+    QElapsedTimer timer;
+    timer.start();
+    {
+        auto backend = new AceTreeJournalBackend();
+        backend->setDurability(AceTreeJournalBackend::Durability(durability));
+        backend->setIoUring(ioUring);
+        if (!backend->start(path)) {
+            delete backend;
+            return -1;
+        }
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.commitTransaction();
+
+        // Small edits in a row, as in rapid editing
+        auto root = model.rootItem();
+        for (int i = 0; i < count; ++i) {
+            model.beginTransaction();
+            root->setProperty("value", i);
+            model.commitTransaction();
+        }
+
+        // The worker is joined when the model is destroyed
+    }
+    return timer.nsecsElapsed();
+}
+
+void tst_Benchmark::commitThroughput_data() {
+    addDurabilityColumns({100, 1000});
+}
+
+void tst_Benchmark::commitThroughput() {
+    QFETCH(int, count);
+    QFETCH(int, durability);
+    QFETCH(bool, ioUring);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    auto elapsed = runCommits(dir.path(), count, durability, ioUring);
+    QVERIFY(elapsed > 0);
+
+    QTest::setBenchmarkResult(qreal(count) * 1000000000 / elapsed, QTest::Events);
+}
+
+void tst_Benchmark::durableLatency_data() {
+    addDurabilityColumns({1});
+}
+
+void tst_Benchmark::durableLatency() {
+    QFETCH(int, count);
+    QFETCH(int, durability);
+    QFETCH(bool, ioUring);
+
+    // Time until a single commit is written by the worker
+    const int times = 10;
+    qint64 elapsed = 0;
+    for (int i = 0; i < times; ++i) {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+
+        auto cur = runCommits(dir.path(), count, durability, ioUring);
+        QVERIFY(cur > 0);
+        elapsed += cur;
+    }
+
+    QTest::setBenchmarkResult(qreal(elapsed) / times / 1000000, QTest::WalltimeMilliseconds);
+}
+
+static void buildHistory(AceTreeModel &model, int count) {
+    model.beginTransaction();
+    model.setRootItem(createItem("root"));
+    model.commitTransaction();
+
+    // A large transaction mixing all kinds of operations
+    model.beginTransaction();
+    auto root = model.rootItem();
+    for (int i = 0; i < count; ++i) {
+        auto child = createItem(QString::number(i));
+        root->appendRow(child);
+        child->setProperty("value", i);
+        child->appendBytes(QByteArray(16, char(i)));
+        root->addRecord(createItem("record"));
+    }
+    root->removeRows(0, count / 2);
+    model.commitTransaction();
+}
+
+static void addCompactColumns() {
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("compact");
+
+    QTest::newRow("1000-events") << 1000 << false;
+    QTest::newRow("1000-compact") << 1000 << true;
+    QTest::newRow("100000-events") << 100000 << false;
+    QTest::newRow("100000-compact") << 100000 << true;
+}
+
+void tst_Benchmark::undoRedoLatency_data() {
+    addCompactColumns();
+}
+
+void tst_Benchmark::undoRedoLatency() {
+    QFETCH(int, count);
+    QFETCH(bool, compact);
+
+    auto backend = new AceTreeMemBackend();
+    backend->setCompactHistory(compact);
+
+    AceTreeModel model(backend);
+    buildHistory(model, count);
+
+    const int times = 10;
+    qint64 elapsed = 0;
+    for (int i = 0; i < times; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        model.previousStep();
+        model.nextStep();
+        elapsed += timer.nsecsElapsed();
+    }
+
+    QTest::setBenchmarkResult(qreal(elapsed) / times / 1000000, QTest::WalltimeMilliseconds);
+}
+
+void tst_Benchmark::historyMemory_data() {
+    addCompactColumns();
+}
+
+void tst_Benchmark::historyMemory() {
+    QFETCH(int, count);
+    QFETCH(bool, compact);
+
+    auto backend = new AceTreeMemBackend();
+    backend->setCompactHistory(compact);
+
+    AceTreeModel model(backend);
+    buildHistory(model, count);
+
+    QTest::setBenchmarkResult(backend->historyMemoryUsage(), QTest::BytesAllocated);
+}
+
+void tst_Benchmark::recoveryTime_data() {
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("10000") << 10000;
+    QTest::newRow("1000000") << 1000000;
+}
+
+void tst_Benchmark::recoveryTime() {
+    QFETCH(int, count);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // Split into top-level subtrees, enough steps to write a checkpoint
+    const int subtrees = 16;
+    {
+        auto backend = new AceTreeJournalBackend();
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        for (int i = 0; i < subtrees; ++i) {
+            model.rootItem()->appendRow(createTree(count / subtrees));
+        }
+        model.commitTransaction();
+
+        for (int i = 0; i < backend->maxReservedSteps(); ++i) {
+            model.beginTransaction();
+            model.rootItem()->setProperty("value", i);
+            model.commitTransaction();
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto backend = new AceTreeJournalBackend();
+    QVERIFY(backend->recover(dir.path()));
+    auto elapsed = timer.nsecsElapsed();
+
+    AceTreeModel model(backend);
+    QCOMPARE(model.rootItem()->rowCount(), subtrees);
+
+    QTest::setBenchmarkResult(qreal(elapsed) / 1000000, QTest::WalltimeMilliseconds);
+}
+
+void tst_Benchmark::workerLatency_data() {
+    QTest::addColumn<int>("idle");
+
+    QTest::newRow("busy") << 0;
+    QTest::newRow("idle-10ms") << 10;
+}
+
+void tst_Benchmark::workerLatency() {
+    QFETCH(int, idle);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    auto backend = new AceTreeJournalBackend();
+    backend->setDurability(AceTreeJournalBackend::NoSync);
+    QVERIFY(backend->start(dir.path()));
+
+    AceTreeModel model(backend);
+
+    model.beginTransaction();
+    model.setRootItem(createItem("root"));
+    model.commitTransaction();
+
+    // Time from a commit until its record reaches the journal, after the worker has been idle
+    const int times = 100;
+    qint64 elapsed = 0;
+    for (int i = 0; i < times; ++i) {
+        if (idle > 0) {
+            QThread::msleep(idle);
+            QCoreApplication::processEvents();
+        }
+
+        auto step = model.currentStep() + 1;
+        QFileInfo info(dir.filePath(
+            QString("journal_%1.dat").arg((step - 1) / backend->maxReservedSteps())));
+        auto size = info.exists() ? info.size() : 0;
+
+        QElapsedTimer timer;
+        timer.start();
+        model.beginTransaction();
+        model.rootItem()->setProperty("value", i);
+        model.commitTransaction();
+
+        do {
+            info.refresh();
+        } while (info.size() <= size);
+        elapsed += timer.nsecsElapsed();
+    }
+
+    QTest::setBenchmarkResult(qreal(elapsed) / times, QTest::WalltimeNanoseconds);
+}
+
+void tst_Benchmark::scrubThroughput_data() {
+    addDurabilityColumns({1000});
+}
+
+void tst_Benchmark::scrubThroughput() {
+    QFETCH(int, count);
+    QFETCH(int, durability);
+    QFETCH(bool, ioUring);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // Undo and redo within the steps in memory, the time includes writing the steps
+    const int steps = 4;
+    QElapsedTimer timer;
+    {
+        auto backend = new AceTreeJournalBackend();
+        backend->setDurability(AceTreeJournalBackend::Durability(durability));
+        backend->setIoUring(ioUring);
+        QVERIFY(backend->start(dir.path()));
+
+        AceTreeModel model(backend);
+
+        model.beginTransaction();
+        model.setRootItem(createItem("root"));
+        model.commitTransaction();
+
+        for (int i = 0; i < steps; ++i) {
+            model.beginTransaction();
+            model.rootItem()->setProperty("value", i);
+            model.commitTransaction();
+        }
+
+        timer.start();
+        for (int i = 0; i < count; ++i) {
+            model.previousStep();
+            model.nextStep();
+        }
+    }
+    auto elapsed = timer.nsecsElapsed();
+
+    QTest::setBenchmarkResult(qreal(count) * 2 * 1000000000 / elapsed, QTest::Events);
+}
+
+QTEST_GUILESS_MAIN(tst_Benchmark)
+#include "tst_Benchmark.moc"